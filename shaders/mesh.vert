@@ -0,0 +1,55 @@
+#version 450
+
+// struct PackedVertex: unorm16 position over the bounding box, octahedral snorm16 normal
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec2 normal;
+
+layout(push_constant) uniform MeshConstants {
+    // dequantization into the unit sphere around the mesh, fixed per mesh
+    mat4 model;
+} constants;
+
+// Streamed every frame through the uniform ring, bound with dynamic offsets.
+layout(set = 0, binding = 0) uniform CameraUniforms {
+    mat4 view_projection;
+    // world space
+    vec4 light_direction;
+} camera;
+
+layout(set = 0, binding = 1) uniform ObjectUniforms {
+    // rotation and translation only, so it also turns the normal
+    mat4 world;
+    // colour of the detail level drawn
+    vec4 tint;
+} object;
+
+// Feature toggles, see enum ShaderFeature. Each variant is compiled with
+// them fixed, so a disabled feature costs nothing.
+layout(constant_id = 0) const bool LIGHTING = true;
+layout(constant_id = 1) const bool LOD_TINT = false;
+// per-vertex colour from the normal instead of one flat colour
+layout(constant_id = 2) const bool NORMAL_COLOR = false;
+
+layout(location = 0) out vec3 fragColor;
+
+vec3 decode_octahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), step(0.0, n.xy));
+    }
+    return normalize(n);
+}
+
+void main() {
+    gl_Position = camera.view_projection * object.world * constants.model * vec4(position.xyz, 1.0);
+    vec3 world_normal = mat3(object.world) * decode_octahedral(normal);
+    vec3 color = NORMAL_COLOR ? world_normal * 0.5 + 0.5 : vec3(0.85, 0.8, 0.7);
+    if (LOD_TINT) {
+        color *= object.tint.rgb;
+    }
+    if (LIGHTING) {
+        float diffuse = max(dot(world_normal, camera.light_direction.xyz), 0.0);
+        color = vec3(0.15) + color * diffuse;
+    }
+    fragColor = color;
+}
@@ -0,0 +1,17 @@
+#version 450
+
+// struct OverlayVertex: pixels from the top left corner, unorm8 colour
+layout(location = 0) in uvec2 position;
+layout(location = 1) in vec4 color;
+
+layout(push_constant) uniform OverlayConstants {
+    // 2 / swapchain size, pixels to normalized device coordinates
+    vec2 pixel_scale;
+} constants;
+
+layout(location = 0) out vec4 fragColor;
+
+void main() {
+    gl_Position = vec4(vec2(position) * constants.pixel_scale - 1.0, 0.0, 1.0);
+    fragColor = color;
+}
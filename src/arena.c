@@ -0,0 +1,66 @@
+#include "arena.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static atomic_uint_fast64_t heap_allocations;
+
+void* heap_alloc(size_t size) {
+	atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+	return malloc(size);
+}
+
+void heap_free(void* ptr) {
+	free(ptr);
+}
+
+uint64_t heap_alloc_count() {
+	return atomic_load_explicit(&heap_allocations, memory_order_relaxed);
+}
+
+bool arena_init(struct Arena* arena, const char* name, size_t capacity) {
+	arena->name = name;
+	arena->base = heap_alloc(capacity);
+	arena->capacity = arena->base ? capacity : 0;
+	arena->offset = 0;
+	arena->high_water = 0;
+	if (!arena->base) {
+		printf("Failed to reserve %zu bytes for the %s arena.\n", capacity, name);
+		return false;
+	}
+	return true;
+}
+
+void arena_destroy(struct Arena* arena) {
+	heap_free(arena->base);
+	arena->base = NULL;
+	arena->capacity = 0;
+	arena->offset = 0;
+}
+
+void* arena_alloc(struct Arena* arena, size_t size, size_t align) {
+	size_t start = (arena->offset + align - 1) & ~(align - 1);
+	if (start + size > arena->capacity) {
+		printf("The %s arena is exhausted. requested: %zu, used: %zu/%zu\n",
+			arena->name, size, arena->offset, arena->capacity);
+		return NULL;
+	}
+	arena->offset = start + size;
+	if (arena->offset > arena->high_water) {
+		arena->high_water = arena->offset;
+	}
+	return arena->base + start;
+}
+
+size_t arena_mark(struct Arena* arena) {
+	return arena->offset;
+}
+
+void arena_rewind(struct Arena* arena, size_t mark) {
+	arena->offset = mark;
+}
+
+void arena_reset(struct Arena* arena) {
+	arena->offset = 0;
+}
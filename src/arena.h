@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Linear (bump) allocator. Allocations are never freed one by one: the whole
+// arena is rewound to a mark or reset at once. Not thread safe, every arena
+// has a single owning thread.
+struct Arena {
+	const char* name;
+	uint8_t* base;
+	size_t capacity;
+	size_t offset;
+	size_t high_water;
+};
+
+bool arena_init(struct Arena* arena, const char* name, size_t capacity);
+void arena_destroy(struct Arena* arena);
+void* arena_alloc(struct Arena* arena, size_t size, size_t align);
+size_t arena_mark(struct Arena* arena);
+void arena_rewind(struct Arena* arena, size_t mark);
+void arena_reset(struct Arena* arena);
+
+#define ARENA_ARRAY(arena, type, count) \
+	((type*) arena_alloc((arena), sizeof(type) * (count), _Alignof(type)))
+
+// Every long-lived CPU allocation of the renderer goes through these, so the
+// frame loop can tell its own allocations apart from those malloc_count.h sees.
+void* heap_alloc(size_t size);
+void heap_free(void* ptr);
+uint64_t heap_alloc_count();
+
+#endif
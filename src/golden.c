@@ -0,0 +1,106 @@
+#include "golden.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "image_writer.h"
+
+static bool read_ppm_header(FILE* fp, uint32_t* width, uint32_t* height) {
+	unsigned int w = 0, h = 0, max_value = 0;
+	if (fscanf(fp, "P6 %u %u %u", &w, &h, &max_value) != 3 || max_value != 255) {
+		return false;
+	}
+	// a single whitespace byte separates the header from the pixels
+	fgetc(fp);
+	*width = w;
+	*height = h;
+	return true;
+}
+
+static bool write_frame(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t row_pitch, bool bgra) {
+	uint8_t* row_buffer = heap_alloc((size_t) width * 3 + 1);
+	bool ok = row_buffer && write_image_file(path, IMAGE_FILE_PPM, pixels, width, height, row_pitch, bgra, row_buffer);
+	heap_free(row_buffer);
+	return ok;
+}
+
+bool update_golden(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t row_pitch, bool bgra) {
+	bool ok = write_frame(path, pixels, width, height, row_pitch, bgra);
+	if (ok) {
+		printf("Golden image %s updated.\n", path);
+	}
+	return ok;
+}
+
+bool compare_with_golden(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height,
+	uint32_t row_pitch, bool bgra, uint32_t tolerance, double max_mismatch_ratio, struct GoldenResult* result) {
+	*result = (struct GoldenResult) {};
+	result->total_pixels = (uint64_t) width * height;
+
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Golden image %s is missing. Run with --update-golden to create it.\n", path);
+		return false;
+	}
+	uint32_t golden_width, golden_height;
+	if (!read_ppm_header(fp, &golden_width, &golden_height)) {
+		printf("Golden image %s is not a binary PPM.\n", path);
+		fclose(fp);
+		return false;
+	}
+	if (golden_width != width || golden_height != height) {
+		printf("Golden image %s is %ux%u, the frame is %ux%u.\n", path, golden_width, golden_height, width, height);
+		fclose(fp);
+		return false;
+	}
+
+	uint8_t* golden_row = heap_alloc((size_t) width * 3);
+	bool complete = golden_row != NULL;
+	for (uint32_t y = 0; complete && y < height; y++) {
+		if (fread(golden_row, (size_t) width * 3, 1, fp) != 1) {
+			complete = false;
+			break;
+		}
+		const uint8_t* row = pixels + (size_t) y * row_pitch;
+		for (uint32_t x = 0; x < width; x++) {
+			const uint8_t rgb[3] = {
+				row[x * 4 + (bgra ? 2 : 0)],
+				row[x * 4 + 1],
+				row[x * 4 + (bgra ? 0 : 2)],
+			};
+			uint32_t pixel_difference = 0;
+			for (int c = 0; c < 3; c++) {
+				uint32_t difference = abs((int) rgb[c] - (int) golden_row[x * 3 + c]);
+				if (difference > pixel_difference) {
+					pixel_difference = difference;
+				}
+			}
+			if (pixel_difference > result->max_difference) {
+				result->max_difference = pixel_difference;
+			}
+			if (pixel_difference > tolerance) {
+				result->mismatched_pixels++;
+			}
+		}
+	}
+	heap_free(golden_row);
+	fclose(fp);
+	if (!complete) {
+		printf("Golden image %s is truncated.\n", path);
+		return false;
+	}
+
+	result->matched = result->mismatched_pixels <= max_mismatch_ratio * result->total_pixels;
+	printf("Golden comparison against %s: %s. max difference: %u, mismatched pixels: %lu/%lu\n",
+		path, result->matched ? "passed" : "FAILED", result->max_difference,
+		(unsigned long) result->mismatched_pixels, (unsigned long) result->total_pixels);
+	if (!result->matched) {
+		char actual_path[1024];
+		snprintf(actual_path, sizeof(actual_path), "%s.actual.ppm", path);
+		if (write_frame(actual_path, pixels, width, height, row_pitch, bgra)) {
+			printf("Rendered frame written to %s.\n", actual_path);
+		}
+	}
+	return result->matched;
+}
@@ -0,0 +1,24 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct GoldenResult {
+	bool matched;
+	uint32_t max_difference;
+	uint64_t mismatched_pixels;
+	uint64_t total_pixels;
+};
+
+// Compares a rendered 8-bit, 4 channel frame against a binary PPM reference.
+// A pixel mismatches when any channel differs by more than tolerance, and the
+// frame matches when at most max_mismatch_ratio of its pixels mismatch. On a
+// mismatch the frame is written next to the reference as <path>.actual.ppm.
+bool compare_with_golden(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height,
+	uint32_t row_pitch, bool bgra, uint32_t tolerance, double max_mismatch_ratio, struct GoldenResult* result);
+
+// Stores the frame as the new reference image.
+bool update_golden(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t row_pitch, bool bgra);
+
+#endif
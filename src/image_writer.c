@@ -0,0 +1,335 @@
+#include "image_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+
+static const double EXPORT_REPORT_INTERVAL = 2.0;
+
+static double writer_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool parse_image_file_format(const char* name, enum ImageFileFormat* format) {
+	if (strcmp(name, "png") == 0) {
+		*format = IMAGE_FILE_PNG;
+	} else if (strcmp(name, "ppm") == 0) {
+		*format = IMAGE_FILE_PPM;
+	} else if (strcmp(name, "raw") == 0) {
+		*format = IMAGE_FILE_RAW;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+const char* image_file_extension(enum ImageFileFormat format) {
+	switch (format) {
+		case IMAGE_FILE_PNG: return "png";
+		case IMAGE_FILE_PPM: return "ppm";
+		case IMAGE_FILE_RAW: return "raw";
+	}
+	return "bin";
+}
+
+static void convert_row(uint8_t* dst, const uint8_t* src, uint32_t width, bool bgra) {
+	for (uint32_t x = 0; x < width; x++) {
+		dst[x * 3 + 0] = src[x * 4 + (bgra ? 2 : 0)];
+		dst[x * 3 + 1] = src[x * 4 + 1];
+		dst[x * 3 + 2] = src[x * 4 + (bgra ? 0 : 2)];
+	}
+}
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table() {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
+	}
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t* data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static void put_be32(uint8_t* out, uint32_t value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+}
+
+static void write_png_chunk(FILE* fp, const char* type, const uint8_t* data, uint32_t size) {
+	uint8_t header[8];
+	put_be32(header, size);
+	memcpy(header + 4, type, 4);
+	fwrite(header, 8, 1, fp);
+	if (size > 0) {
+		fwrite(data, size, 1, fp);
+	}
+	uint32_t crc = crc_update(0xffffffffu, (const uint8_t*) type, 4);
+	crc = crc_update(crc, data, size) ^ 0xffffffffu;
+	uint8_t footer[4];
+	put_be32(footer, crc);
+	fwrite(footer, 4, 1, fp);
+}
+
+// The image data goes out as a single IDAT chunk holding a zlib stream of
+// stored (uncompressed) deflate blocks. Encoding is then a copy plus two
+// checksums, which keeps the writer thread ahead of the render loop.
+struct PngStream {
+	FILE* fp;
+	uint32_t crc;
+	uint32_t adler_a;
+	uint32_t adler_b;
+	uint32_t block_left;
+	uint64_t raw_left;
+};
+
+static const uint32_t DEFLATE_STORED_BLOCK = 65535;
+
+static void png_stream_put(struct PngStream* stream, const uint8_t* data, size_t size) {
+	fwrite(data, size, 1, stream->fp);
+	stream->crc = crc_update(stream->crc, data, size);
+}
+
+static void png_stream_write(struct PngStream* stream, const uint8_t* data, uint32_t size) {
+	while (size > 0) {
+		if (stream->block_left == 0) {
+			uint32_t block = stream->raw_left < DEFLATE_STORED_BLOCK ? (uint32_t) stream->raw_left : DEFLATE_STORED_BLOCK;
+			uint8_t header[5] = {
+				stream->raw_left == block ? 1 : 0,
+				block & 0xff, block >> 8,
+				~block & 0xff, (~block >> 8) & 0xff,
+			};
+			png_stream_put(stream, header, 5);
+			stream->block_left = block;
+		}
+		uint32_t n = size < stream->block_left ? size : stream->block_left;
+		png_stream_put(stream, data, n);
+		for (uint32_t i = 0; i < n; i++) {
+			stream->adler_a = (stream->adler_a + data[i]) % 65521;
+			stream->adler_b = (stream->adler_b + stream->adler_a) % 65521;
+		}
+		stream->block_left -= n;
+		stream->raw_left -= n;
+		data += n;
+		size -= n;
+	}
+}
+
+static bool write_png(FILE* fp, const uint8_t* pixels, uint32_t width, uint32_t height,
+	uint32_t row_pitch, bool bgra, uint8_t* row_buffer) {
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	fwrite(signature, 8, 1, fp);
+
+	uint8_t ihdr[13];
+	put_be32(ihdr, width);
+	put_be32(ihdr + 4, height);
+	ihdr[8] = 8; // bit depth
+	ihdr[9] = 2; // truecolor
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	write_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+
+	uint32_t row_size = width * 3 + 1;
+	uint64_t raw_size = (uint64_t) row_size * height;
+	uint64_t block_count = (raw_size + DEFLATE_STORED_BLOCK - 1) / DEFLATE_STORED_BLOCK;
+	uint64_t idat_size = 2 + raw_size + block_count * 5 + 4;
+	if (raw_size == 0 || idat_size > 0x7fffffffu) {
+		return false;
+	}
+
+	uint8_t header[8];
+	put_be32(header, (uint32_t) idat_size);
+	memcpy(header + 4, "IDAT", 4);
+	fwrite(header, 8, 1, fp);
+
+	struct PngStream stream = {
+		.fp = fp,
+		.crc = crc_update(0xffffffffu, (const uint8_t*) "IDAT", 4),
+		.adler_a = 1,
+		.adler_b = 0,
+		.block_left = 0,
+		.raw_left = raw_size,
+	};
+	static const uint8_t zlib_header[2] = {0x78, 0x01};
+	png_stream_put(&stream, zlib_header, 2);
+	for (uint32_t y = 0; y < height; y++) {
+		row_buffer[0] = 0; // filter: none
+		convert_row(row_buffer + 1, pixels + (size_t) y * row_pitch, width, bgra);
+		png_stream_write(&stream, row_buffer, row_size);
+	}
+	uint8_t adler[4];
+	put_be32(adler, (stream.adler_b << 16) | stream.adler_a);
+	png_stream_put(&stream, adler, 4);
+
+	uint8_t footer[4];
+	put_be32(footer, stream.crc ^ 0xffffffffu);
+	fwrite(footer, 4, 1, fp);
+
+	write_png_chunk(fp, "IEND", NULL, 0);
+	return true;
+}
+
+bool write_image_file(const char* path, enum ImageFileFormat format, const uint8_t* pixels,
+	uint32_t width, uint32_t height, uint32_t row_pitch, bool bgra, uint8_t* row_buffer) {
+	pthread_once(&crc_table_once, build_crc_table);
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL) {
+		printf("Failed to open %s for writing.\n", path);
+		return false;
+	}
+
+	bool ok = true;
+	if (format == IMAGE_FILE_PNG) {
+		ok = write_png(fp, pixels, width, height, row_pitch, bgra, row_buffer);
+	} else {
+		if (format == IMAGE_FILE_PPM) {
+			fprintf(fp, "P6\n%u %u\n255\n", width, height);
+		}
+		for (uint32_t y = 0; y < height; y++) {
+			convert_row(row_buffer, pixels + (size_t) y * row_pitch, width, bgra);
+			fwrite(row_buffer, width * 3, 1, fp);
+		}
+	}
+	if (ferror(fp)) {
+		ok = false;
+	}
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		printf("Failed to write %s.\n", path);
+	}
+	return ok;
+}
+
+static void report_export_rate(struct ImageWriter* writer, bool final) {
+	double now = writer_now();
+	uint64_t frames = atomic_load(&writer->frames_written);
+	if (final) {
+		double elapsed = now - writer->start_time;
+		printf("Exported %lu frames in %.1f s: %.1f frames/s, %.1f MB/s to disk.\n",
+			(unsigned long) frames, elapsed,
+			elapsed > 0.0 ? frames / elapsed : 0.0,
+			elapsed > 0.0 ? atomic_load(&writer->bytes_written) / elapsed / 1e6 : 0.0);
+		return;
+	}
+	if (now - writer->report_time >= EXPORT_REPORT_INTERVAL) {
+		printf("Export: %.1f frames/s to disk\n", (frames - writer->reported_frames) / (now - writer->report_time));
+		writer->reported_frames = frames;
+		writer->report_time = now;
+	}
+}
+
+static void* image_writer_main(void* arg) {
+	struct ImageWriter* writer = arg;
+	char path[1024];
+	pthread_mutex_lock(&writer->lock);
+	for (;;) {
+		while (writer->count == 0 && writer->running) {
+			pthread_cond_wait(&writer->cond, &writer->lock);
+		}
+		if (writer->count == 0) {
+			break;
+		}
+		struct ImageJob job = writer->queue[writer->head];
+		writer->head = (writer->head + 1) % IMAGE_WRITER_QUEUE_SIZE;
+		writer->count--;
+		pthread_mutex_unlock(&writer->lock);
+
+		snprintf(path, sizeof(path), "%s/frame_%06lu.%s",
+			writer->directory, (unsigned long) job.frame, image_file_extension(writer->format));
+		if (job.width * 3 + 1 <= writer->row_buffer_size &&
+			write_image_file(path, writer->format, job.pixels, job.width, job.height, job.row_pitch, job.bgra, writer->row_buffer)) {
+			atomic_fetch_add(&writer->frames_written, 1);
+			atomic_fetch_add(&writer->bytes_written, (uint64_t) job.width * job.height * 3);
+		}
+		atomic_store(job.busy, 0);
+		report_export_rate(writer, false);
+
+		pthread_mutex_lock(&writer->lock);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return NULL;
+}
+
+bool image_writer_start(struct ImageWriter* writer, const char* directory, enum ImageFileFormat format, uint32_t max_width) {
+	writer->directory = directory;
+	writer->format = format;
+	writer->head = 0;
+	writer->count = 0;
+	writer->running = true;
+	writer->row_buffer_size = max_width * 3 + 1;
+	writer->row_buffer = heap_alloc(writer->row_buffer_size);
+	writer->started = false;
+	if (!writer->row_buffer) {
+		printf("Failed to allocate the %u byte row buffer of the image writer.\n", writer->row_buffer_size);
+		return false;
+	}
+	atomic_init(&writer->frames_written, 0);
+	atomic_init(&writer->bytes_written, 0);
+	writer->start_time = writer_now();
+	writer->report_time = writer->start_time;
+	writer->reported_frames = 0;
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	writer->started = pthread_create(&writer->thread, NULL, image_writer_main, writer) == 0;
+	if (!writer->started) {
+		printf("Failed to start the image writer thread.\n");
+		// image_writer_stop() does nothing for a writer that never started
+		pthread_mutex_destroy(&writer->lock);
+		pthread_cond_destroy(&writer->cond);
+		heap_free(writer->row_buffer);
+		writer->row_buffer = NULL;
+	}
+	return writer->started;
+}
+
+bool image_writer_submit(struct ImageWriter* writer, const struct ImageJob* job) {
+	if (!writer->started) {
+		return false;
+	}
+	bool queued = false;
+	pthread_mutex_lock(&writer->lock);
+	if (writer->count < IMAGE_WRITER_QUEUE_SIZE) {
+		writer->queue[(writer->head + writer->count) % IMAGE_WRITER_QUEUE_SIZE] = *job;
+		writer->count++;
+		queued = true;
+		pthread_cond_signal(&writer->cond);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return queued;
+}
+
+void image_writer_stop(struct ImageWriter* writer) {
+	if (!writer->started) {
+		return;
+	}
+	pthread_mutex_lock(&writer->lock);
+	writer->running = false;
+	pthread_cond_signal(&writer->cond);
+	pthread_mutex_unlock(&writer->lock);
+	pthread_join(writer->thread, NULL);
+	writer->started = false;
+
+	report_export_rate(writer, true);
+	pthread_mutex_destroy(&writer->lock);
+	pthread_cond_destroy(&writer->cond);
+	heap_free(writer->row_buffer);
+	writer->row_buffer = NULL;
+}
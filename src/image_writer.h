@@ -0,0 +1,66 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IMAGE_WRITER_QUEUE_SIZE 8
+
+enum ImageFileFormat {
+	IMAGE_FILE_PNG,
+	IMAGE_FILE_PPM,
+	IMAGE_FILE_RAW,
+};
+
+// A mapped frame handed to the writer thread. The writer stores 0 to *busy
+// once the pixels have been consumed, which hands the memory back to the
+// render loop.
+struct ImageJob {
+	const uint8_t* pixels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t row_pitch;
+	bool bgra;
+	uint64_t frame;
+	atomic_int* busy;
+};
+
+// Encodes frames to disk on its own thread so the render loop never waits on I/O.
+struct ImageWriter {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct ImageJob queue[IMAGE_WRITER_QUEUE_SIZE];
+	uint32_t head;
+	uint32_t count;
+	bool running;
+	bool started;
+	const char* directory;
+	enum ImageFileFormat format;
+	uint8_t* row_buffer;
+	uint32_t row_buffer_size;
+	// written by the worker, read by anyone
+	atomic_uint_fast64_t frames_written;
+	atomic_uint_fast64_t bytes_written;
+	double start_time;
+	double report_time;
+	uint64_t reported_frames;
+};
+
+bool parse_image_file_format(const char* name, enum ImageFileFormat* format);
+const char* image_file_extension(enum ImageFileFormat format);
+
+bool image_writer_start(struct ImageWriter* writer, const char* directory, enum ImageFileFormat format, uint32_t max_width);
+// Never blocks on I/O. Returns false when the queue is full, in which case the job is not taken.
+bool image_writer_submit(struct ImageWriter* writer, const struct ImageJob* job);
+// Drains the queue, joins the thread and prints the sustained export rate.
+void image_writer_stop(struct ImageWriter* writer);
+
+// Writes one 8-bit, 4 channel image as RGB. row_buffer must hold at least
+// width * 3 + 1 bytes. Used by the writer thread and for one-off captures.
+bool write_image_file(const char* path, enum ImageFileFormat format, const uint8_t* pixels,
+	uint32_t width, uint32_t height, uint32_t row_pitch, bool bgra, uint8_t* row_buffer);
+
+#endif
@@ -0,0 +1,293 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct JsonParser {
+	struct Arena* arena;
+	const char* at;
+	const char* end;
+};
+
+static const uint32_t JSON_MAX_DEPTH = 64;
+
+static void skip_whitespace(struct JsonParser* parser) {
+	while (parser->at < parser->end &&
+		(*parser->at == ' ' || *parser->at == '\t' || *parser->at == '\n' || *parser->at == '\r')) {
+		parser->at++;
+	}
+}
+
+static bool consume(struct JsonParser* parser, char c) {
+	skip_whitespace(parser);
+	if (parser->at < parser->end && *parser->at == c) {
+		parser->at++;
+		return true;
+	}
+	return false;
+}
+
+static bool consume_literal(struct JsonParser* parser, const char* literal) {
+	size_t length = strlen(literal);
+	if ((size_t) (parser->end - parser->at) < length || memcmp(parser->at, literal, length) != 0) {
+		return false;
+	}
+	parser->at += length;
+	return true;
+}
+
+static void append_utf8(char* out, size_t* length, uint32_t code) {
+	if (code < 0x80) {
+		out[(*length)++] = code;
+	} else if (code < 0x800) {
+		out[(*length)++] = 0xc0 | (code >> 6);
+		out[(*length)++] = 0x80 | (code & 0x3f);
+	} else {
+		out[(*length)++] = 0xe0 | (code >> 12);
+		out[(*length)++] = 0x80 | ((code >> 6) & 0x3f);
+		out[(*length)++] = 0x80 | (code & 0x3f);
+	}
+}
+
+static const char* parse_string(struct JsonParser* parser) {
+	if (!consume(parser, '"')) {
+		return NULL;
+	}
+	const char* start = parser->at;
+	while (parser->at < parser->end && *parser->at != '"') {
+		parser->at += *parser->at == '\\' ? 2 : 1;
+	}
+	if (parser->at >= parser->end) {
+		return NULL;
+	}
+	// unescaping never makes a string longer
+	char* out = ARENA_ARRAY(parser->arena, char, parser->at - start + 1);
+	if (!out) {
+		return NULL;
+	}
+	size_t length = 0;
+	for (const char* c = start; c < parser->at; c++) {
+		if (*c != '\\') {
+			out[length++] = *c;
+			continue;
+		}
+		c++;
+		switch (*c) {
+			case 'b': out[length++] = '\b'; break;
+			case 'f': out[length++] = '\f'; break;
+			case 'n': out[length++] = '\n'; break;
+			case 'r': out[length++] = '\r'; break;
+			case 't': out[length++] = '\t'; break;
+			case 'u': {
+				// surrogate pairs are not combined, glTF keys and URIs are ASCII
+				char hex[5] = {};
+				if (parser->at - c < 5) {
+					return NULL;
+				}
+				memcpy(hex, c + 1, 4);
+				append_utf8(out, &length, strtoul(hex, NULL, 16));
+				c += 4;
+				break;
+			}
+			default: out[length++] = *c; break;
+		}
+	}
+	out[length] = '\0';
+	parser->at++;
+	return out;
+}
+
+static bool parse_value(struct JsonParser* parser, struct JsonValue* value, uint32_t depth);
+
+// Members are parsed into a chain of arena blocks first, since the count is
+// only known at the closing bracket, then copied into one array.
+struct JsonChunk {
+	struct JsonValue items[16];
+	const char* keys[16];
+	uint32_t count;
+	struct JsonChunk* next;
+};
+
+static bool parse_container(struct JsonParser* parser, struct JsonValue* value, bool object, uint32_t depth) {
+	char close = object ? '}' : ']';
+	value->type = object ? JSON_OBJECT : JSON_ARRAY;
+	value->count = 0;
+	if (consume(parser, close)) {
+		return true;
+	}
+	struct JsonChunk* first = ARENA_ARRAY(parser->arena, struct JsonChunk, 1);
+	if (!first) {
+		return false;
+	}
+	first->count = 0;
+	first->next = NULL;
+	struct JsonChunk* chunk = first;
+	do {
+		if (chunk->count == 16) {
+			chunk->next = ARENA_ARRAY(parser->arena, struct JsonChunk, 1);
+			if (!chunk->next) {
+				return false;
+			}
+			chunk = chunk->next;
+			chunk->count = 0;
+			chunk->next = NULL;
+		}
+		if (object) {
+			chunk->keys[chunk->count] = parse_string(parser);
+			if (!chunk->keys[chunk->count] || !consume(parser, ':')) {
+				return false;
+			}
+		}
+		if (!parse_value(parser, &chunk->items[chunk->count], depth + 1)) {
+			return false;
+		}
+		chunk->count++;
+		value->count++;
+	} while (consume(parser, ','));
+	if (!consume(parser, close)) {
+		return false;
+	}
+
+	// the chunks stay behind in the arena, nested values were allocated after them
+	value->items = ARENA_ARRAY(parser->arena, struct JsonValue, value->count);
+	value->keys = object ? ARENA_ARRAY(parser->arena, const char*, value->count) : NULL;
+	if (!value->items || (object && !value->keys)) {
+		return false;
+	}
+	uint32_t index = 0;
+	for (chunk = first; chunk; chunk = chunk->next) {
+		memcpy(value->items + index, chunk->items, sizeof(struct JsonValue) * chunk->count);
+		if (object) {
+			memcpy(value->keys + index, chunk->keys, sizeof(const char*) * chunk->count);
+		}
+		index += chunk->count;
+	}
+	return true;
+}
+
+static bool parse_value(struct JsonParser* parser, struct JsonValue* value, uint32_t depth) {
+	memset(value, 0, sizeof(*value));
+	if (depth > JSON_MAX_DEPTH) {
+		return false;
+	}
+	skip_whitespace(parser);
+	if (parser->at >= parser->end) {
+		return false;
+	}
+	switch (*parser->at) {
+		case '{':
+			parser->at++;
+			return parse_container(parser, value, true, depth);
+		case '[':
+			parser->at++;
+			return parse_container(parser, value, false, depth);
+		case '"':
+			value->type = JSON_STRING;
+			value->string = parse_string(parser);
+			return value->string != NULL;
+		case 't':
+			value->type = JSON_BOOL;
+			value->boolean = true;
+			return consume_literal(parser, "true");
+		case 'f':
+			value->type = JSON_BOOL;
+			return consume_literal(parser, "false");
+		case 'n':
+			value->type = JSON_NULL;
+			return consume_literal(parser, "null");
+		default: {
+			// strtod needs a terminated string, numbers are short
+			char number[64];
+			size_t length = 0;
+			while (parser->at + length < parser->end && length < sizeof(number) - 1 &&
+				strchr("+-0123456789.eE", parser->at[length])) {
+				length++;
+			}
+			if (length == 0) {
+				return false;
+			}
+			memcpy(number, parser->at, length);
+			number[length] = '\0';
+			value->type = JSON_NUMBER;
+			value->number = strtod(number, NULL);
+			parser->at += length;
+			return true;
+		}
+	}
+}
+
+struct JsonValue* json_parse(struct Arena* arena, const char* text, size_t size) {
+	struct JsonParser parser = {
+		.arena = arena,
+		.at = text,
+		.end = text + size,
+	};
+	struct JsonValue* root = ARENA_ARRAY(arena, struct JsonValue, 1);
+	if (!root || !parse_value(&parser, root, 0)) {
+		printf("Failed to parse JSON near offset %ld.\n", (long) (parser.at - text));
+		return NULL;
+	}
+	return root;
+}
+
+size_t json_arena_size(const char* text, size_t size) {
+	size_t containers = 0;
+	size_t commas = 0;
+	size_t strings = 0;
+	bool in_string = false;
+	for (size_t i = 0; i < size; i++) {
+		char c = text[i];
+		if (in_string) {
+			if (c == '\\') {
+				i++;
+			} else if (c == '"') {
+				in_string = false;
+			}
+		} else if (c == '"') {
+			in_string = true;
+			strings++;
+		} else if (c == '{' || c == '[') {
+			containers++;
+		} else if (c == ',') {
+			commas++;
+		}
+	}
+	// the first member of a container comes without a comma, every other one after one
+	size_t values = commas + containers + 1;
+	// a container's members fill one chunk after another, at most values / 16 of them are full
+	size_t chunks = containers + values / 16;
+	// members are copied into one array of values and one of keys per container
+	size_t nodes = values * (sizeof(struct JsonValue) + sizeof(const char*)) + sizeof(struct JsonValue);
+	// unescaped strings are no longer than in the text, plus their terminators
+	size_t characters = size + strings;
+	size_t allocations = chunks + containers * 2 + strings + 1;
+	return chunks * sizeof(struct JsonChunk) + nodes + characters + allocations * _Alignof(struct JsonValue);
+}
+
+struct JsonValue* json_member(struct JsonValue* object, const char* key) {
+	if (!object || object->type != JSON_OBJECT) {
+		return NULL;
+	}
+	for (uint32_t i = 0; i < object->count; i++) {
+		if (strcmp(object->keys[i], key) == 0) {
+			return &object->items[i];
+		}
+	}
+	return NULL;
+}
+
+struct JsonValue* json_index(struct JsonValue* array, uint32_t index) {
+	if (!array || array->type != JSON_ARRAY || index >= array->count) {
+		return NULL;
+	}
+	return &array->items[index];
+}
+
+double json_number(struct JsonValue* value, double fallback) {
+	return value && value->type == JSON_NUMBER ? value->number : fallback;
+}
+
+const char* json_string(struct JsonValue* value) {
+	return value && value->type == JSON_STRING ? value->string : NULL;
+}
@@ -0,0 +1,46 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+enum JsonType {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+// Parsed JSON document node. Strings are unescaped and NUL terminated; object
+// members keep their order, keys[i] names items[i].
+struct JsonValue {
+	enum JsonType type;
+	bool boolean;
+	double number;
+	const char* string;
+	struct JsonValue* items;
+	const char** keys;
+	uint32_t count;
+};
+
+// Parses a complete document, every node and string is allocated from arena.
+// Returns NULL on a syntax error or when the arena is exhausted.
+struct JsonValue* json_parse(struct Arena* arena, const char* text, size_t size);
+// Arena bytes that are always enough for json_parse() of text, counted from
+// its containers, commas and strings. Compact JSON needs far more per byte
+// of text than indented JSON, so the text size alone is no guide.
+size_t json_arena_size(const char* text, size_t size);
+
+// Lookups return NULL, or fallback, when the member or index is missing or of
+// another type, so chains of them can be checked once at the end.
+struct JsonValue* json_member(struct JsonValue* object, const char* key);
+struct JsonValue* json_index(struct JsonValue* array, uint32_t index);
+double json_number(struct JsonValue* value, double fallback);
+const char* json_string(struct JsonValue* value);
+
+#endif
@@ -7,6 +7,22 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "arena.h"
+#include "golden.h"
+#include "image_writer.h"
+#include "malloc_count.h"
+#include "mesh.h"
+#include "metrics_server.h"
+#include "overlay.h"
+#include "pipeline_variants.h"
+#include "stats.h"
+#include "triple_buffer.h"
+#include "uniform_ring.h"
 
 const char * VALIDATION_LAYERS[] = {
 	"VK_LAYER_KHRONOS_validation"
@@ -16,7 +32,89 @@ const char* DEVICE_EXTENSIONS[] = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME 
 };
 
+#define READBACK_RING_SIZE 3
+#define FRAMES_IN_FLIGHT 2
+// Headless frames render into image frame_index % OFFSCREEN_IMAGE_COUNT, so
+// each image belongs to one frame slot and that slot's fence guards its reuse.
+#define OFFSCREEN_IMAGE_COUNT FRAMES_IN_FLIGHT
+
+enum Scene {
+	SCENE_TRIANGLE,
+	SCENE_GRID,
+	SCENE_FIELD,
+};
+
+// Host-visible buffer a rendered frame is copied into for export. busy is set
+// when the copy is recorded and cleared by the writer thread once the frame
+// has been encoded.
+struct ReadbackSlot {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	void* mapped;
+	bool coherent;
+	atomic_int busy;
+	uint64_t frame;
+};
+
+// Everything a submitted frame uses until its fence signals. The frame after
+// next reuses the slot, so one frame can be recorded while the previous one
+// is still rendering.
+struct FrameSlot {
+	VkCommandBuffer command_buffer;
+	// --static: one per swapchain image, recorded against this slot's uniform region
+	VkCommandBuffer* image_command_buffers;
+	bool commands_dirty;
+	VkSemaphore image_available_semaphore;
+	VkSemaphore render_finished_semaphore;
+	VkFence in_flight_fence;
+	struct ReadbackSlot* readback;
+	double input_time;
+	// the submit wrote this slot's pipeline statistics query, to be read once its fence signals
+	bool statistics_pending;
+};
+
+// Push constants of shaders/mesh.vert: object space to the unit sphere around
+// the mesh, dequantization included. Fixed for the mesh.
+struct MeshConstants {
+	float model[16];
+};
+
+// Uniform blocks of shaders/mesh.vert, std140. Both are streamed through the
+// uniform ring every frame and bound with dynamic offsets.
+struct CameraUniforms {
+	float view_projection[16];
+	// world space, towards the light
+	float light_direction[4];
+};
+
+struct ObjectUniforms {
+	// rotation and translation only, so it turns normals as well
+	float world[16];
+	// colour of the instance's detail level, read by the lod-tint variant
+	float tint[4];
+};
+
+// One drawn copy of the mesh. pixels_per_unit is the screen size of one object
+// space unit at the instance, which picks its detail level.
+struct MeshInstance {
+	float world[16];
+	float pixels_per_unit;
+	uint32_t lod;
+	bool visible;
+	// ObjectUniforms of this frame, relative to the start of its ring region
+	uint32_t uniform_offset;
+};
+
+// One indexed draw of the frame's draw list.
+struct MeshDraw {
+	uint32_t index_count;
+	uint32_t first_index;
+	uint32_t uniform_offset;
+};
+
 struct Renderer {
+	bool headless;
+	enum Scene scene;
 	VkSurfaceKHR surface;
 	VkInstance instance;
 	VkPhysicalDevice physical_device;
@@ -29,15 +127,248 @@ struct Renderer {
 	VkImageView* swap_chain_image_views;
 	VkFormat swap_chain_image_format;
 	VkExtent2D swap_chain_extent;
+	VkColorSpaceKHR swap_chain_color_space;
+	// layout the render pass leaves the image in: PRESENT_SRC, or TRANSFER_SRC when headless
+	VkImageLayout final_layout;
+	VkDeviceMemory offscreen_memory[OFFSCREEN_IMAGE_COUNT];
 	VkPipelineLayout pipeline_layout;
 	VkRenderPass render_pass;
+	VkPipelineCache pipeline_cache;
+	VkShaderModule vertex_shader;
+	VkShaderModule fragment_shader;
+	// every variant built so far, and the one frames are recorded with
+	struct PipelineVariants pipelines;
 	VkPipeline graphics_pipeline;
+	uint32_t shader_features;
+	// --msaa: rendering goes to a multisampled colour image that the render
+	// pass resolves into the swapchain image
+	VkSampleCountFlagBits samples;
+	VkImage color_image;
+	VkDeviceMemory color_memory;
+	VkImageView color_view;
 	VkFramebuffer* swapchain_frame_buffers;
 	VkCommandPool command_pool;
-	VkCommandBuffer command_buffer;
-	VkSemaphore image_available_semaphore;
-	VkSemaphore render_finished_semaphore;
-	VkFence in_flight_fence;
+	struct FrameSlot frames[FRAMES_IN_FLIGHT];
+	bool static_commands;
+	VkCommandPool transient_command_pool;
+	VkFence transient_fence;
+	struct Arena startup_arena;
+	struct Arena frame_arena;
+	double launch_time;
+	bool presented;
+	double cpu_frame_time_total;
+	uint64_t cpu_frame_samples;
+	double cpu_report_time;
+	uint64_t frame_index;
+	bool exporting;
+	// the readback ring exists, for --export or a --golden capture
+	bool readback_enabled;
+	struct ReadbackSlot readback_slots[READBACK_RING_SIZE];
+	// captured by the last frame submitted, for --golden
+	struct ReadbackSlot* last_readback;
+	bool capture_next_frame;
+	uint64_t readback_dropped;
+	struct ImageWriter image_writer;
+	// Input-to-photon latency: from the newest input event a frame reflects
+	// to the GPU finishing that frame, ahead of scanout.
+	double newest_input_time;
+	double pending_input_time;
+	double latency_total;
+	double latency_max;
+	uint64_t latency_samples;
+	// --mesh: quantized geometry drawn with a depth buffer instead of the triangle
+	bool mesh_enabled;
+	VkBuffer mesh_vertex_buffer;
+	VkDeviceMemory mesh_vertex_memory;
+	VkBuffer mesh_index_buffer;
+	VkDeviceMemory mesh_index_memory;
+	VkIndexType mesh_index_type;
+	struct MeshLod mesh_lods[MESH_MAX_LODS];
+	uint32_t mesh_lod_count;
+	struct MeshConstants mesh_constants;
+	// radius of the bounding sphere in object space
+	float mesh_radius;
+	struct MeshInstance* mesh_instances;
+	uint32_t mesh_instance_count;
+	// the visible instances of this frame, in the frame arena until its next reset
+	struct MeshDraw* mesh_draws;
+	uint32_t mesh_draw_count;
+	// per-frame camera and object blocks of the mesh shader
+	struct UniformRing uniforms;
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool descriptor_pool;
+	VkDescriptorSet descriptor_set;
+	uint32_t camera_uniform_offset;
+	// what the last frame drew
+	uint64_t mesh_triangles;
+	uint32_t mesh_lod_histogram[MESH_MAX_LODS];
+	VkFormat depth_format;
+	VkImage depth_image;
+	VkDeviceMemory depth_memory;
+	VkImageView depth_view;
+	// runtime statistics, shown by the overlay and served by the metrics endpoint
+	struct FrameHistory frame_history;
+	double last_frame_start;
+	struct MemoryTracker memory;
+	// one pipeline statistics query per frame slot, VK_NULL_HANDLE when the device has none
+	VkQueryPool statistics_pool;
+	bool has_pipeline_statistics;
+	struct PipelineStatistics pipeline_statistics;
+	VkPresentModeKHR present_mode;
+	uint64_t presents;
+	uint64_t present_errors;
+	// since the last snapshot
+	double stats_cpu_total;
+	double stats_acquire_total;
+	double stats_present_total;
+	uint64_t stats_samples;
+	double stats_time;
+	struct StatsSnapshot stats;
+	bool metrics_enabled;
+	struct MetricsServer metrics;
+	// --overlay: drawn last in the render pass from a ring of host-visible
+	// memory, each region an indirect draw command followed by the vertices
+	bool overlay_available;
+	bool overlay_enabled;
+	VkPipelineLayout overlay_layout;
+	VkPipeline overlay_pipeline;
+	struct UniformRing overlay_ring;
+	char overlay_text[1024];
+};
+
+// Application state produced by the input thread and consumed by the render
+// thread, one packet per update.
+struct FramePacket {
+	enum Scene scene;
+	uint32_t shader_features;
+	bool overlay;
+	// time of the newest input event folded into this packet, 0 before any input
+	double input_time;
+};
+
+// State shared between the input thread (main) and the render thread.
+struct RenderLoop {
+	struct Renderer* renderer;
+	struct Options* options;
+	struct TripleBuffer packets;
+	struct FramePacket packet_slots[TRIPLE_BUFFER_SLOTS];
+	atomic_bool running;
+	// results, read once the render thread has been joined
+	uint64_t frame_count;
+	double frame_ms;
+};
+
+// Input seen by the GLFW callbacks. Only touched on the main thread.
+struct InputState {
+	enum Scene scene;
+	uint32_t shader_features;
+	bool overlay;
+	double input_time;
+	bool mesh_enabled;
+};
+
+struct Options {
+	bool static_commands;
+	const char* export_directory;
+	enum ImageFileFormat export_format;
+	bool headless;
+	uint32_t width;
+	uint32_t height;
+	uint64_t frames;
+	enum Scene scene;
+	const char* golden_path;
+	bool update_golden;
+	uint32_t tolerance;
+	double max_frame_ms;
+	const char* mesh_path;
+	uint32_t shader_features;
+	uint32_t msaa_samples;
+	bool overlay;
+	const char* metrics_socket;
+	const char* metrics_file;
+};
+
+// Files read off the critical path by the startup loader task.
+struct PipelineSources {
+	char* vshader_code;
+	long vshader_size;
+	char* fshader_code;
+	long fshader_size;
+	char* overlay_vshader_code;
+	long overlay_vshader_size;
+	char* overlay_fshader_code;
+	long overlay_fshader_size;
+	char* cache_data;
+	long cache_size;
+	const char* mesh_path;
+	struct MappedMesh mesh;
+};
+
+// A unit of startup work running on its own thread. Tasks that depend on
+// another one call wait_task() on it before touching its results.
+struct StartupTask {
+	pthread_t thread;
+	bool started;
+};
+
+const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+const size_t STARTUP_ARENA_SIZE = 256 * 1024;
+const size_t FRAME_ARENA_SIZE = 64 * 1024;
+const double CPU_REPORT_INTERVAL = 2.0;
+const uint64_t HEADLESS_DEFAULT_FRAMES = 60;
+const double GOLDEN_MAX_MISMATCH = 0.001;
+const uint32_t GRID_SIZE = 8;
+const double UPDATE_INTERVAL = 1.0 / 240.0;
+const uint64_t WARMUP_FRAMES = 3;
+// fixed view of --mesh: a slight turn so the mesh reads as 3D, and a margin around it
+const float MESH_YAW = 0.6f;
+const float MESH_PITCH = 0.35f;
+const float MESH_VIEW_MARGIN = 0.9f;
+// --scene field: FIELD_SIZE x FIELD_SIZE copies of the mesh on the ground,
+// seen through a perspective camera that dollies out and back in
+const uint32_t FIELD_SIZE = 16;
+const float FIELD_SPACING = 3.0f;
+const float FIELD_FOV_Y = 1.0471976f;
+const float FIELD_NEAR = 0.1f;
+const float FIELD_FAR = 200.0f;
+const float FIELD_CAMERA_HEIGHT = 6.0f;
+const float FIELD_CAMERA_PITCH = 0.35f;
+const float FIELD_CAMERA_NEAREST = 4.0f;
+const float FIELD_DOLLY_DISTANCE = 40.0f;
+const float FIELD_DOLLY_FRAMES = 1200.0f;
+// Each instance draws the coarsest level whose error projects to at most
+// LOD_PIXEL_ERROR pixels. Going coarser needs the error to fit within
+// LOD_HYSTERESIS of that, so an instance sitting at a threshold does not pop
+// back and forth every frame.
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.8f;
+// how often the overlay text and the metrics endpoint are refreshed
+const double STATS_INTERVAL = 0.5;
+// The overlay sits in the top left corner: the stats text above a bar graph
+// of the last frame times, one bar per frame and full height at
+// OVERLAY_GRAPH_MS, with a mark at 60 Hz.
+#define OVERLAY_MAX_VERTICES 32768
+const int32_t OVERLAY_MARGIN = 8;
+const uint32_t OVERLAY_GRAPH_FRAMES = 120;
+const int32_t OVERLAY_GRAPH_BAR = 3;
+const int32_t OVERLAY_GRAPH_HEIGHT = 64;
+const float OVERLAY_GRAPH_MS = 50.0f;
+const float OVERLAY_TARGET_MS = 1000.0f / 60.0f;
+const uint8_t OVERLAY_BACKDROP[4] = {0, 0, 0, 176};
+const uint8_t OVERLAY_TEXT_COLOR[4] = {235, 235, 235, 255};
+const uint8_t OVERLAY_GOOD[4] = {80, 220, 100, 255};
+const uint8_t OVERLAY_SLOW[4] = {240, 200, 60, 255};
+const uint8_t OVERLAY_BAD[4] = {240, 70, 60, 255};
+// lod-tint shader feature: full detail keeps the base colour, coarser levels shift towards red
+const float LOD_TINTS[MESH_MAX_LODS][4] = {
+	{1.0f, 1.0f, 1.0f, 1.0f},
+	{0.55f, 1.0f, 0.55f, 1.0f},
+	{0.5f, 0.75f, 1.0f, 1.0f},
+	{1.0f, 1.0f, 0.45f, 1.0f},
+	{1.0f, 0.7f, 0.35f, 1.0f},
+	{1.0f, 0.45f, 0.85f, 1.0f},
+	{1.0f, 0.35f, 0.35f, 1.0f},
+	{0.7f, 0.2f, 0.2f, 1.0f},
 };
 
 
@@ -60,20 +391,47 @@ struct SwapChainDetails {
 };
 
 
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 char* read_file(const char* file_name, long* size) {
-	FILE* fp = fopen(file_name, "r");
+	FILE* fp = fopen(file_name, "rb");
 	char* buffer = NULL;
-	if (fp != NULL) {
-		fseek(fp, 0, SEEK_END);
-		*size = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		buffer = malloc(*size);
-		fread(buffer, *size, 1, fp);
+	*size = 0;
+	if (fp == NULL) {
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buffer = heap_alloc(*size);
+	if (fread(buffer, *size, 1, fp) != 1) {
+		heap_free(buffer);
+		buffer = NULL;
+		*size = 0;
 	}
 	fclose(fp);
 	return buffer;
 }
 
+void start_task(struct StartupTask* task, void* (*run)(void*), void* arg) {
+	task->started = pthread_create(&task->thread, NULL, run, arg) == 0;
+	if (!task->started) {
+		// no thread available, fall back to running the task inline
+		run(arg);
+	}
+}
+
+void wait_task(struct StartupTask* task) {
+	if (task->started) {
+		pthread_join(task->thread, NULL);
+		task->started = false;
+	}
+}
+
 void create_sync_objects(struct Renderer* renderer) {
 	VkSemaphoreCreateInfo semaphore_info = {};
 	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -82,18 +440,127 @@ void create_sync_objects(struct Renderer* renderer) {
 	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	if (vkCreateSemaphore(renderer->logical_device, &semaphore_info, NULL, &renderer->image_available_semaphore) != VK_SUCCESS ||
-    	vkCreateSemaphore(renderer->logical_device, &semaphore_info, NULL, &renderer->render_finished_semaphore) != VK_SUCCESS ||
-    	vkCreateFence(renderer->logical_device, &fence_info, NULL, &renderer->in_flight_fence) != VK_SUCCESS) {
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		struct FrameSlot* frame = &renderer->frames[i];
+		if (vkCreateSemaphore(renderer->logical_device, &semaphore_info, NULL, &frame->image_available_semaphore) != VK_SUCCESS ||
+			vkCreateSemaphore(renderer->logical_device, &semaphore_info, NULL, &frame->render_finished_semaphore) != VK_SUCCESS ||
+			vkCreateFence(renderer->logical_device, &fence_info, NULL, &frame->in_flight_fence) != VK_SUCCESS) {
+			printf("Failed to create the sync objects of frame slot %u.\n", i);
+		}
+	}
+}
+
+// One query per frame slot, reset and written by every command buffer of the slot.
+void create_statistics_queries(struct Renderer* renderer) {
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(renderer->physical_device, &features);
+	if (!features.pipelineStatisticsQuery) {
+		printf("Pipeline statistics queries not supported, the counters are left out.\n");
+		return;
+	}
+	VkQueryPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	pool_info.queryCount = FRAMES_IN_FLIGHT;
+	pool_info.pipelineStatistics = PIPELINE_STATISTICS_FLAGS;
+	VkResult result = vkCreateQueryPool(renderer->logical_device, &pool_info, NULL, &renderer->statistics_pool);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create the statistics query pool. Error code: %d\n", result);
+		renderer->statistics_pool = VK_NULL_HANDLE;
+	}
+}
+
+
+void record_readback(struct Renderer* renderer, VkCommandBuffer command_buffer, uint32_t image_index, struct ReadbackSlot* slot) {
+	VkImageMemoryBarrier to_transfer = {};
+	to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	to_transfer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	to_transfer.oldLayout = renderer->final_layout;
+	to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_transfer.image = renderer->swap_chain_images[image_index];
+	to_transfer.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	to_transfer.subresourceRange.levelCount = 1;
+	to_transfer.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, NULL, 0, NULL, 1, &to_transfer);
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = renderer->swap_chain_extent.width;
+	region.imageExtent.height = renderer->swap_chain_extent.height;
+	region.imageExtent.depth = 1;
+	vkCmdCopyImageToBuffer(command_buffer, renderer->swap_chain_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		slot->buffer, 1, &region);
+
+	VkImageMemoryBarrier to_present = to_transfer;
+	to_present.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	to_present.dstAccessMask = 0;
+	to_present.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	to_present.newLayout = renderer->final_layout;
+
+	VkBufferMemoryBarrier to_host = {};
+	to_host.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	to_host.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	to_host.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	to_host.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_host.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_host.buffer = slot->buffer;
+	to_host.offset = 0;
+	to_host.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		0, 0, NULL, 1, &to_host, 1, &to_present);
+}
+
+void record_draws(struct Renderer* renderer, VkCommandBuffer command_buffer) {
+	if (!renderer->mesh_enabled) {
+		vkCmdDraw(command_buffer, 3, 1, 0, 0);
+		return;
+	}
+	for (uint32_t i = 0; i < renderer->mesh_draw_count; i++) {
+		const struct MeshDraw* draw = &renderer->mesh_draws[i];
+		// the blocks sit in the region of the frame being recorded, at the same place every frame
+		uint32_t offsets[] = {
+			renderer->uniforms.region_offset + renderer->camera_uniform_offset,
+			renderer->uniforms.region_offset + draw->uniform_offset,
+		};
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipeline_layout, 0, 1,
+			&renderer->descriptor_set, 2, offsets);
+		vkCmdDrawIndexed(command_buffer, draw->index_count, 1, draw->first_index, 0, 0);
 	}
 }
 
+// The draw reads its vertex count from the ring, so a pre-recorded command
+// buffer shows the overlay of whichever frame it is submitted for.
+void record_overlay(struct Renderer* renderer, VkCommandBuffer command_buffer) {
+	VkBuffer buffer = renderer->overlay_ring.buffer;
+	VkDeviceSize region = renderer->overlay_ring.region_offset;
+	VkDeviceSize vertices = region + sizeof(VkDrawIndirectCommand);
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->overlay_pipeline);
+	vkCmdBindVertexBuffers(command_buffer, 0, 1, &buffer, &vertices);
+	float pixel_scale[2] = {2.0f / renderer->swap_chain_extent.width, 2.0f / renderer->swap_chain_extent.height};
+	vkCmdPushConstants(command_buffer, renderer->overlay_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pixel_scale),
+		pixel_scale);
+	VkViewport viewport = {};
+	viewport.width = renderer->swap_chain_extent.width;
+	viewport.height = renderer->swap_chain_extent.height;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	vkCmdDrawIndirect(command_buffer, buffer, region, 1, sizeof(VkDrawIndirectCommand));
+}
 
-void record_command_buffer(struct Renderer* renderer, uint32_t image_index) {
+// slot picks the frame slot's statistics query and, through the rings'
+// current regions, its uniforms and overlay.
+void record_command_buffer(struct Renderer* renderer, VkCommandBuffer command_buffer, uint32_t image_index,
+	uint32_t slot, struct ReadbackSlot* readback) {
 	VkCommandBufferBeginInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-	VkResult begin_buffer_res = vkBeginCommandBuffer(renderer->command_buffer, &info);
+	VkResult begin_buffer_res = vkBeginCommandBuffer(command_buffer, &info);
 
 	if (begin_buffer_res != VK_SUCCESS) {
 		printf("Failed to create begin command buffer. code: %d\n", begin_buffer_res);
@@ -106,49 +573,809 @@ void record_command_buffer(struct Renderer* renderer, uint32_t image_index) {
 	begin_render_pass_info.renderArea.offset = offs; 
 	begin_render_pass_info.renderArea.extent = renderer->swap_chain_extent;
 	
-	VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-	begin_render_pass_info.clearValueCount = 1;
-	begin_render_pass_info.pClearValues = &clearColor;
+	VkClearValue clear_values[2] = {};
+	clear_values[0].color = (VkClearColorValue) {{0.0f, 0.0f, 0.0f, 1.0f}};
+	clear_values[1].depthStencil.depth = 1.0f;
+	begin_render_pass_info.clearValueCount = renderer->mesh_enabled ? 2 : 1;
+	begin_render_pass_info.pClearValues = clear_values;
+
+	if (renderer->statistics_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(command_buffer, renderer->statistics_pool, slot, 1);
+	}
+	vkCmdBeginRenderPass(command_buffer, &begin_render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+	if (renderer->statistics_pool != VK_NULL_HANDLE) {
+		vkCmdBeginQuery(command_buffer, renderer->statistics_pool, slot, 0);
+	}
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->graphics_pipeline);
+	if (renderer->mesh_enabled) {
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, &renderer->mesh_vertex_buffer, &offset);
+		vkCmdBindIndexBuffer(command_buffer, renderer->mesh_index_buffer, 0, renderer->mesh_index_type);
+		vkCmdPushConstants(command_buffer, renderer->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+			sizeof(struct MeshConstants), &renderer->mesh_constants);
+	}
+
+	VkViewport viewport = {};
+	viewport.width = renderer->swap_chain_extent.width;
+	viewport.height = renderer->swap_chain_extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {
+		.offset = {0, 0},
+		.extent = renderer->swap_chain_extent,
+	};
+	vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+	if (renderer->scene == SCENE_GRID) {
+		// the same triangle drawn once per cell, each cell its own viewport
+		float cell_width = (float) renderer->swap_chain_extent.width / GRID_SIZE;
+		float cell_height = (float) renderer->swap_chain_extent.height / GRID_SIZE;
+		for (uint32_t y = 0; y < GRID_SIZE; y++) {
+			for (uint32_t x = 0; x < GRID_SIZE; x++) {
+				VkViewport cell = viewport;
+				cell.x = x * cell_width;
+				cell.y = y * cell_height;
+				cell.width = cell_width;
+				cell.height = cell_height;
+				vkCmdSetViewport(command_buffer, 0, 1, &cell);
+				record_draws(renderer, command_buffer);
+			}
+		}
+	} else {
+		record_draws(renderer, command_buffer);
+	}
+	// the scene only, the overlay's own draw is left out of the counters
+	if (renderer->statistics_pool != VK_NULL_HANDLE) {
+		vkCmdEndQuery(command_buffer, renderer->statistics_pool, slot);
+	}
+	if (renderer->overlay_enabled) {
+		record_overlay(renderer, command_buffer);
+	}
+	vkCmdEndRenderPass(command_buffer);
 
-	vkCmdBeginRenderPass(renderer->command_buffer, &begin_render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(renderer->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->graphics_pipeline);
-	vkCmdDraw(renderer->command_buffer, 3, 1, 0, 0);
-	vkCmdEndRenderPass(renderer->command_buffer);
+	if (readback) {
+		record_readback(renderer, command_buffer, image_index, readback);
+	}
 
-	if (vkEndCommandBuffer(renderer->command_buffer) != VK_SUCCESS) {
+	if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
 		printf("Failed to end command buffer\n");
 	}
 }
 
 
+// Static mode: one command buffer per swapchain image and frame slot, recorded
+// once and re-submitted every frame until something marks the commands dirty.
+// Uniform data changes by itself do not, it is re-read from the ring at submit.
+void record_static_command_buffers(struct Renderer* renderer, struct FrameSlot* frame) {
+	uint32_t slot = (uint32_t) (frame - renderer->frames);
+	for (uint32_t i = 0; i < renderer->swap_chain_image_count; i++) {
+		record_command_buffer(renderer, frame->image_command_buffers[i], i, slot, NULL);
+	}
+	frame->commands_dirty = false;
+	printf("Recorded %u static command buffers.\n", renderer->swap_chain_image_count);
+}
+
+void mark_commands_dirty(struct Renderer* renderer) {
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		renderer->frames[i].commands_dirty = true;
+	}
+}
+
+void report_cpu_frame_time(struct Renderer* renderer, double cpu_time) {
+	renderer->cpu_frame_time_total += cpu_time;
+	renderer->cpu_frame_samples++;
+	double now = now_seconds();
+	if (now - renderer->cpu_report_time >= CPU_REPORT_INTERVAL) {
+		printf("CPU frame cost (%s): %.2f us over %lu frames\n",
+			renderer->static_commands ? "static" : "re-recorded",
+			renderer->cpu_frame_time_total / renderer->cpu_frame_samples * 1e6,
+			(unsigned long) renderer->cpu_frame_samples);
+		renderer->cpu_frame_time_total = 0.0;
+		renderer->cpu_frame_samples = 0;
+		renderer->cpu_report_time = now;
+		if (renderer->latency_samples > 0) {
+			printf("Input to photon: %.2f ms average, %.2f ms max over %lu inputs\n",
+				renderer->latency_total / renderer->latency_samples * 1000.0, renderer->latency_max * 1000.0,
+				(unsigned long) renderer->latency_samples);
+			renderer->latency_total = 0.0;
+			renderer->latency_max = 0.0;
+			renderer->latency_samples = 0;
+		}
+		if (renderer->mesh_enabled) {
+			printf("Mesh: %lu triangles per frame, draws per detail level:", (unsigned long) renderer->mesh_triangles);
+			for (uint32_t i = 0; i < renderer->mesh_lod_count; i++) {
+				printf(" %u", renderer->mesh_lod_histogram[i]);
+			}
+			printf("\n");
+		}
+	}
+}
+
+
+struct ReadbackSlot* acquire_readback_slot(struct Renderer* renderer) {
+	for (uint32_t i = 0; i < READBACK_RING_SIZE; i++) {
+		struct ReadbackSlot* slot = &renderer->readback_slots[i];
+		if (atomic_load(&slot->busy) == 0) {
+			atomic_store(&slot->busy, 1);
+			slot->frame = renderer->frame_index;
+			return slot;
+		}
+	}
+	// every slot is still being written out, skip this frame rather than wait on the disk
+	renderer->readback_dropped++;
+	return NULL;
+}
+
+bool is_bgra_format(VkFormat format) {
+	return format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM;
+}
+
+// Makes the GPU writes visible to the host. Only valid once the fence of the
+// frame that filled the slot has signalled.
+const uint8_t* map_readback(struct Renderer* renderer, struct ReadbackSlot* slot) {
+	if (!slot->coherent) {
+		VkMappedMemoryRange range = {};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = slot->memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(renderer->logical_device, 1, &range);
+	}
+	return slot->mapped;
+}
+
+void hand_off_readback(struct Renderer* renderer, struct ReadbackSlot* slot) {
+	struct ImageJob job = {
+		.pixels = map_readback(renderer, slot),
+		.width = renderer->swap_chain_extent.width,
+		.height = renderer->swap_chain_extent.height,
+		.row_pitch = renderer->swap_chain_extent.width * 4,
+		.bgra = is_bgra_format(renderer->swap_chain_image_format),
+		.frame = slot->frame,
+		.busy = &slot->busy,
+	};
+	if (!image_writer_submit(&renderer->image_writer, &job)) {
+		renderer->readback_dropped++;
+		atomic_store(&slot->busy, 0);
+	}
+}
+
+// Column-major, as GLSL expects.
+void mat4_multiply(float* out, const float* a, const float* b) {
+	float result[16];
+	for (uint32_t column = 0; column < 4; column++) {
+		for (uint32_t row = 0; row < 4; row++) {
+			float sum = 0.0f;
+			for (uint32_t k = 0; k < 4; k++) {
+				sum += a[k * 4 + row] * b[column * 4 + k];
+			}
+			result[column * 4 + row] = sum;
+		}
+	}
+	memcpy(out, result, sizeof(result));
+}
+
+// World space direction towards a light from the upper left.
+void mesh_light_direction(float* out) {
+	float light[3] = {-0.4f, 0.7f, 0.6f};
+	float length = sqrtf(light[0] * light[0] + light[1] * light[1] + light[2] * light[2]);
+	for (uint32_t i = 0; i < 3; i++) {
+		out[i] = light[i] / length;
+	}
+	out[3] = 0.0f;
+}
+
+// The coarsest level whose error stays under a pixel at this size. Levels
+// coarser than the current one have to clear the lower hysteresis threshold.
+uint32_t select_mesh_lod(struct Renderer* renderer, float pixels_per_unit, uint32_t current) {
+	for (uint32_t lod = renderer->mesh_lod_count - 1; lod > 0; lod--) {
+		float limit = lod > current ? LOD_PIXEL_ERROR * LOD_HYSTERESIS : LOD_PIXEL_ERROR;
+		if (renderer->mesh_lods[lod].error * pixels_per_unit <= limit) {
+			return lod;
+		}
+	}
+	return 0;
+}
+
+// The triangle and grid scenes: an orthographic view the unit sphere around
+// the mesh fills, turned slightly so the mesh reads as 3D.
+void place_fitted_instance(struct Renderer* renderer, struct CameraUniforms* camera) {
+	float width = renderer->swap_chain_extent.width;
+	float height = renderer->swap_chain_extent.height;
+	// y flipped for Vulkan, depth runs from 0.25 at z = 1 to 0.75 at z = -1
+	float projection[16] = {
+		MESH_VIEW_MARGIN * fminf(1.0f, height / width), 0.0f, 0.0f, 0.0f,
+		0.0f, -MESH_VIEW_MARGIN * fminf(1.0f, width / height), 0.0f, 0.0f,
+		0.0f, 0.0f, -0.25f, 0.0f,
+		0.0f, 0.0f, 0.5f, 1.0f,
+	};
+	memcpy(camera->view_projection, projection, sizeof(projection));
+	mesh_light_direction(camera->light_direction);
+
+	float cy = cosf(MESH_YAW);
+	float sy = sinf(MESH_YAW);
+	float cp = cosf(MESH_PITCH);
+	float sp = sinf(MESH_PITCH);
+	float yaw[16] = {
+		cy, 0.0f, -sy, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		sy, 0.0f, cy, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f,
+	};
+	float pitch[16] = {
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, cp, sp, 0.0f,
+		0.0f, -sp, cp, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f,
+	};
+	struct MeshInstance* instance = renderer->mesh_instances;
+	renderer->mesh_instance_count = 1;
+	mat4_multiply(instance->world, pitch, yaw);
+	instance->visible = true;
+	// the view covers the shorter side of the window, or of a grid cell
+	float pixels = MESH_VIEW_MARGIN * 0.5f * fminf(width, height);
+	if (renderer->scene == SCENE_GRID) {
+		pixels /= GRID_SIZE;
+	}
+	instance->pixels_per_unit = pixels / renderer->mesh_radius;
+}
+
+// Places the copies of the mesh of --scene field for this frame. The camera
+// position only depends on the frame index, so headless runs are repeatable.
+// Returns whether an instance came into or left the view.
+bool place_field_instances(struct Renderer* renderer, struct CameraUniforms* camera) {
+	float width = renderer->swap_chain_extent.width;
+	float height = renderer->swap_chain_extent.height;
+	float focal = 1.0f / tanf(FIELD_FOV_Y * 0.5f);
+	float aspect = width / height;
+	// y flipped for Vulkan, depth from 0 at the near plane to 1 at the far one
+	float projection[16] = {
+		focal / aspect, 0.0f, 0.0f, 0.0f,
+		0.0f, -focal, 0.0f, 0.0f,
+		0.0f, 0.0f, FIELD_FAR / (FIELD_NEAR - FIELD_FAR), -1.0f,
+		0.0f, 0.0f, FIELD_NEAR * FIELD_FAR / (FIELD_NEAR - FIELD_FAR), 0.0f,
+	};
+	float phase = (float) (renderer->frame_index % (uint64_t) FIELD_DOLLY_FRAMES) / FIELD_DOLLY_FRAMES;
+	float camera_z = FIELD_CAMERA_NEAREST + FIELD_DOLLY_DISTANCE * 0.5f * (1.0f - cosf(phase * 2.0f * (float) M_PI));
+	float cp = cosf(FIELD_CAMERA_PITCH);
+	float sp = sinf(FIELD_CAMERA_PITCH);
+	// looking down the -z axis, tilted towards the ground
+	float view[16] = {
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, cp, sp, 0.0f,
+		0.0f, -sp, cp, 0.0f,
+		0.0f, -FIELD_CAMERA_HEIGHT * cp + camera_z * sp, -FIELD_CAMERA_HEIGHT * sp - camera_z * cp, 1.0f,
+	};
+	mat4_multiply(camera->view_projection, projection, view);
+	mesh_light_direction(camera->light_direction);
+
+	// a sphere is outside when it lies entirely beyond one of the side planes
+	float tan_y = 1.0f / focal;
+	float tan_x = tan_y * aspect;
+	float slack_x = sqrtf(1.0f + tan_x * tan_x);
+	float slack_y = sqrtf(1.0f + tan_y * tan_y);
+	float pixels_per_world_unit = 0.5f * height * focal;
+	bool visibility_changed = renderer->mesh_instance_count != FIELD_SIZE * FIELD_SIZE;
+	renderer->mesh_instance_count = FIELD_SIZE * FIELD_SIZE;
+	for (uint32_t row = 0; row < FIELD_SIZE; row++) {
+		for (uint32_t column = 0; column < FIELD_SIZE; column++) {
+			struct MeshInstance* instance = &renderer->mesh_instances[row * FIELD_SIZE + column];
+			float yaw = MESH_YAW + 0.7f * (row * FIELD_SIZE + column);
+			float cy = cosf(yaw);
+			float sy = sinf(yaw);
+			float x = ((float) column - 0.5f * (FIELD_SIZE - 1)) * FIELD_SPACING;
+			float z = -(float) row * FIELD_SPACING;
+			// the unit sphere around the mesh rests on the ground
+			float world[16] = {
+				cy, 0.0f, -sy, 0.0f,
+				0.0f, 1.0f, 0.0f, 0.0f,
+				sy, 0.0f, cy, 0.0f,
+				x, 1.0f, z, 1.0f,
+			};
+			memcpy(instance->world, world, sizeof(world));
+
+			float center[3] = {
+				view[0] * x + view[4] + view[8] * z + view[12],
+				view[1] * x + view[5] + view[9] * z + view[13],
+				view[2] * x + view[6] + view[10] * z + view[14],
+			};
+			float depth = -center[2];
+			bool visible = depth > -1.0f && depth < FIELD_FAR + 1.0f &&
+				fabsf(center[0]) - depth * tan_x <= slack_x && fabsf(center[1]) - depth * tan_y <= slack_y;
+			visibility_changed |= visible != instance->visible;
+			instance->visible = visible;
+			// sized at the nearest point of the sphere, so the error bound holds across it
+			float nearest = fmaxf(depth - 1.0f, FIELD_NEAR);
+			instance->pixels_per_unit = pixels_per_world_unit / nearest / renderer->mesh_radius;
+		}
+	}
+	return visibility_changed;
+}
+
+// Streams this frame's camera and instance transforms into the uniform ring
+// and picks the detail level of every instance. The blocks land at the same
+// offsets every frame while the same instances are drawn, so moving them
+// needs no re-recording; only a changed level or draw list does.
+void update_mesh_instances(struct Renderer* renderer) {
+	struct UniformRing* ring = &renderer->uniforms;
+	struct CameraUniforms camera;
+	bool changed = false;
+	if (renderer->scene == SCENE_FIELD) {
+		changed = place_field_instances(renderer, &camera);
+	} else {
+		place_fitted_instance(renderer, &camera);
+	}
+
+	uint32_t offset = 0;
+	struct CameraUniforms* camera_block = uniform_ring_alloc(ring, sizeof(struct CameraUniforms), &offset);
+	if (camera_block) {
+		memcpy(camera_block, &camera, sizeof(camera));
+		changed |= offset - ring->region_offset != renderer->camera_uniform_offset;
+		renderer->camera_uniform_offset = offset - ring->region_offset;
+	}
+
+	// recording only happens later in the same frame, so the list can live in the frame arena
+	renderer->mesh_draws = ARENA_ARRAY(&renderer->frame_arena, struct MeshDraw, renderer->mesh_instance_count);
+	renderer->mesh_draw_count = 0;
+	uint32_t draws = renderer->scene == SCENE_GRID ? GRID_SIZE * GRID_SIZE : 1;
+	renderer->mesh_triangles = 0;
+	memset(renderer->mesh_lod_histogram, 0, sizeof(renderer->mesh_lod_histogram));
+	for (uint32_t i = 0; i < renderer->mesh_instance_count; i++) {
+		struct MeshInstance* instance = &renderer->mesh_instances[i];
+		if (!instance->visible) {
+			continue;
+		}
+		struct ObjectUniforms* object = camera_block && renderer->mesh_draws ?
+			uniform_ring_alloc(ring, sizeof(struct ObjectUniforms), &offset) : NULL;
+		if (!object) {
+			// both are sized for every instance of the largest scene, this is not expected
+			instance->visible = false;
+			changed = true;
+			continue;
+		}
+		changed |= offset - ring->region_offset != instance->uniform_offset;
+		instance->uniform_offset = offset - ring->region_offset;
+
+		uint32_t lod = select_mesh_lod(renderer, instance->pixels_per_unit, instance->lod);
+		changed |= lod != instance->lod;
+		instance->lod = lod;
+		memcpy(object->world, instance->world, sizeof(instance->world));
+		memcpy(object->tint, LOD_TINTS[lod], sizeof(object->tint));
+		struct MeshDraw* draw = &renderer->mesh_draws[renderer->mesh_draw_count++];
+		draw->index_count = renderer->mesh_lods[lod].index_count;
+		draw->first_index = renderer->mesh_lods[lod].index_offset;
+		draw->uniform_offset = instance->uniform_offset;
+		renderer->mesh_triangles += (uint64_t) draws * renderer->mesh_lods[lod].index_count / 3;
+		renderer->mesh_lod_histogram[lod] += draws;
+	}
+	if (changed) {
+		mark_commands_dirty(renderer);
+	}
+}
+
+// Builds the pipeline of one variant. Only the key differs between variants,
+// everything else is the same fixed state.
+VkPipeline create_graphics_pipeline(struct Renderer* renderer, const struct PipelineKey* key) {
+	// both stages get the same constants, a stage ignores the ones it does not declare
+	struct ShaderSpecialization specialization;
+	shader_specialization_init(&specialization, key->features);
+
+	VkPipelineShaderStageCreateInfo vert_shader_stage_info = {};
+	vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vert_shader_stage_info.pSpecializationInfo = &specialization.info;
+	vert_shader_stage_info.module = renderer->vertex_shader;
+	vert_shader_stage_info.pName = "main";
+
+	VkPipelineShaderStageCreateInfo frag_shader_stage_info = {};
+	frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	frag_shader_stage_info.pSpecializationInfo = &specialization.info;
+	frag_shader_stage_info.module = renderer->fragment_shader;
+	frag_shader_stage_info.pName = "main";
+	
+	VkPipelineShaderStageCreateInfo stages[] = {vert_shader_stage_info, frag_shader_stage_info};
+
+	// struct PackedVertex, the fixed function fetch converts both attributes to float
+	VkVertexInputBindingDescription mesh_binding = {
+		.binding = 0,
+		.stride = sizeof(struct PackedVertex),
+		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+	};
+	VkVertexInputAttributeDescription mesh_attributes[] = {
+		{.location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_UNORM, .offset = offsetof(struct PackedVertex, position)},
+		{.location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM, .offset = offsetof(struct PackedVertex, normal)},
+	};
+	VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+	vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertex_input_info.vertexBindingDescriptionCount = renderer->mesh_enabled ? 1 : 0;
+	vertex_input_info.pVertexBindingDescriptions = &mesh_binding;
+	vertex_input_info.vertexAttributeDescriptionCount = renderer->mesh_enabled ? 2 : 0;
+	vertex_input_info.pVertexAttributeDescriptions = mesh_attributes;
+
+	VkPipelineInputAssemblyStateCreateInfo assembly_info = {};
+	assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	assembly_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	assembly_info.primitiveRestartEnable = VK_FALSE;
+
+	// viewport and scissor are dynamic so the pipeline can be compiled before the swapchain extent is known
+	VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	VkPipelineDynamicStateCreateInfo dynamic_state = {};
+	dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state.dynamicStateCount = 2;
+	dynamic_state.pDynamicStates = dynamic_states;
+
+	VkPipelineViewportStateCreateInfo viewport_state = {};
+	viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport_state.viewportCount = 1;
+	viewport_state.pViewports = NULL;
+	viewport_state.scissorCount = 1;
+	viewport_state.pScissors = NULL;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	// imported meshes wind counter-clockwise, the mesh transform flips y for Vulkan
+	rasterizer.frontFace = renderer->mesh_enabled ? VK_FRONT_FACE_COUNTER_CLOCKWISE : VK_FRONT_FACE_CLOCKWISE;
+	rasterizer.depthBiasEnable = VK_FALSE;
+	rasterizer.depthBiasConstantFactor = 0.0f;
+	rasterizer.depthBiasClamp = 0.0f;
+	rasterizer.depthBiasSlopeFactor = 0.0f;
+
+	VkPipelineMultisampleStateCreateInfo multisampling = {};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = key->samples;
+	multisampling.minSampleShading = 1.0f;
+	multisampling.pSampleMask = NULL;
+	multisampling.alphaToCoverageEnable = VK_FALSE;
+	multisampling.alphaToOneEnable = VK_FALSE;
+
+	VkPipelineColorBlendAttachmentState color_blend_attachment = {};
+	color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT 
+		| VK_COLOR_COMPONENT_G_BIT
+		| VK_COLOR_COMPONENT_B_BIT
+		| VK_COLOR_COMPONENT_A_BIT;
+	color_blend_attachment.blendEnable = VK_FALSE;
+	color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+	color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+	color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
+	color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+	color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+	color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+	
+	VkPipelineColorBlendStateCreateInfo color_bleding = {};
+	color_bleding.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	color_bleding.logicOpEnable = VK_FALSE;
+	color_bleding.logicOp = VK_LOGIC_OP_COPY;
+	color_bleding.attachmentCount = 1;
+	color_bleding.pAttachments = &color_blend_attachment;
+	color_bleding.blendConstants[0] = 0.0f;
+	color_bleding.blendConstants[1] = 0.0f;
+	color_bleding.blendConstants[2] = 0.0f;
+	color_bleding.blendConstants[3] = 0.0f;
+
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = VK_TRUE;
+	depth_stencil.depthWriteEnable = VK_TRUE;
+	depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+	VkGraphicsPipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_info.stageCount = 2;
+	pipeline_info.pStages = stages;
+	// stages
+	pipeline_info.pVertexInputState = &vertex_input_info;
+	pipeline_info.pInputAssemblyState = &assembly_info;
+	pipeline_info.pViewportState = &viewport_state;
+	pipeline_info.pRasterizationState = &rasterizer;
+	pipeline_info.pMultisampleState = &multisampling;
+	pipeline_info.pDepthStencilState = renderer->mesh_enabled ? &depth_stencil : NULL;
+	pipeline_info.pColorBlendState = &color_bleding;
+	pipeline_info.pDynamicState = &dynamic_state;
+	pipeline_info.layout = renderer->pipeline_layout;
+	pipeline_info.renderPass = renderer->render_pass;
+	pipeline_info.subpass = 0;
+	pipeline_info.basePipelineIndex = -1;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+	
+	double compile_start = now_seconds();
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult pipeline_result = vkCreateGraphicsPipelines
+		(renderer->logical_device, renderer->pipeline_cache, 1, &pipeline_info, NULL, &pipeline);
+	char features[64];
+	format_shader_features(key->features, features, sizeof(features));
+	if (pipeline_result != VK_SUCCESS) {
+		printf("Failed to create graphics pipeline. Error code: %d\n", pipeline_result);
+		return VK_NULL_HANDLE;
+	}
+	printf("Graphics pipeline (%s, %ux MSAA) ready in %.1f ms.\n", features, (uint32_t) key->samples,
+		(now_seconds() - compile_start) * 1000.0);
+	return pipeline;
+}
+
+// Switches to the variant with these shader features, building it on first
+// use. Keeps the current pipeline and returns false when that fails.
+bool select_pipeline(struct Renderer* renderer, uint32_t features) {
+	struct PipelineKey key = {
+		// the triangle shader has no features, one variant serves every set
+		.features = renderer->mesh_enabled ? features : 0,
+		.samples = renderer->samples,
+	};
+	// recorded even when the build fails, so a broken variant is not retried every frame
+	renderer->shader_features = features;
+	VkPipeline pipeline = pipeline_variants_find(&renderer->pipelines, &key);
+	if (pipeline == VK_NULL_HANDLE) {
+		pipeline = create_graphics_pipeline(renderer, &key);
+		if (pipeline == VK_NULL_HANDLE) {
+			return false;
+		}
+		if (!pipeline_variants_add(&renderer->pipelines, &key, pipeline)) {
+			printf("Pipeline variant cache is full.\n");
+			vkDestroyPipeline(renderer->logical_device, pipeline, NULL);
+			return false;
+		}
+	}
+	renderer->graphics_pipeline = pipeline;
+	return true;
+}
+
+// Builds this frame's overlay into the slot's region of the overlay ring.
+void update_overlay(struct Renderer* renderer, uint32_t slot) {
+	struct UniformRing* ring = &renderer->overlay_ring;
+	uniform_ring_begin_frame(ring, slot);
+	uint32_t offset = 0;
+	VkDrawIndirectCommand* draw = uniform_ring_alloc(ring, sizeof(VkDrawIndirectCommand), &offset);
+	// reserved whole, so the vertices always start right after the draw command where record_overlay() binds them
+	struct OverlayVertex* vertices =
+		draw ? uniform_ring_alloc(ring, OVERLAY_MAX_VERTICES * sizeof(struct OverlayVertex), &offset) : NULL;
+	if (!vertices) {
+		// the ring is sized for both, this is not expected
+		return;
+	}
+	struct OverlayBuilder builder;
+	overlay_begin(&builder, vertices, OVERLAY_MAX_VERTICES);
+	int32_t text_width = 0;
+	int32_t text_height = 0;
+	overlay_text_extent(renderer->overlay_text, &text_width, &text_height);
+	int32_t graph_width = OVERLAY_GRAPH_FRAMES * OVERLAY_GRAPH_BAR;
+	int32_t graph_bottom = 2 * OVERLAY_MARGIN + text_height + OVERLAY_GRAPH_HEIGHT;
+	overlay_rect(&builder, 0, 0, (text_width > graph_width ? text_width : graph_width) + 2 * OVERLAY_MARGIN,
+		graph_bottom + OVERLAY_MARGIN, OVERLAY_BACKDROP);
+	overlay_text(&builder, OVERLAY_MARGIN, OVERLAY_MARGIN, renderer->overlay_text, OVERLAY_TEXT_COLOR);
+
+	const struct FrameHistory* history = &renderer->frame_history;
+	uint32_t bars = history->count < OVERLAY_GRAPH_FRAMES ? history->count : OVERLAY_GRAPH_FRAMES;
+	for (uint32_t i = 0; i < bars; i++) {
+		float ms = frame_history_get(history, history->count - bars + i);
+		int32_t height = (int32_t) (fminf(ms / OVERLAY_GRAPH_MS, 1.0f) * OVERLAY_GRAPH_HEIGHT);
+		// a little slack for vsync jitter, then up to one missed refresh
+		const uint8_t* color = ms <= OVERLAY_TARGET_MS * 1.05f ? OVERLAY_GOOD :
+			ms <= OVERLAY_TARGET_MS * 2.05f ? OVERLAY_SLOW : OVERLAY_BAD;
+		overlay_rect(&builder, OVERLAY_MARGIN + i * OVERLAY_GRAPH_BAR, graph_bottom - height, OVERLAY_GRAPH_BAR - 1,
+			height, color);
+	}
+	int32_t target = (int32_t) (OVERLAY_TARGET_MS / OVERLAY_GRAPH_MS * OVERLAY_GRAPH_HEIGHT);
+	overlay_rect(&builder, OVERLAY_MARGIN, graph_bottom - target, graph_width, 1, OVERLAY_TEXT_COLOR);
+
+	*draw = (VkDrawIndirectCommand) {
+		.vertexCount = builder.count,
+		.instanceCount = 1,
+	};
+}
+
+// Folds one frame into the statistics. Every STATS_INTERVAL a new snapshot
+// is taken, which refreshes the overlay text and the metrics endpoint.
+void update_stats(struct Renderer* renderer, double frame_start, double cpu_time) {
+	if (renderer->last_frame_start > 0.0) {
+		frame_history_push(&renderer->frame_history, (float) ((frame_start - renderer->last_frame_start) * 1000.0));
+	}
+	renderer->last_frame_start = frame_start;
+	renderer->stats_cpu_total += cpu_time;
+	renderer->stats_samples++;
+	if (frame_start - renderer->stats_time < STATS_INTERVAL) {
+		return;
+	}
+
+	uint32_t draws = renderer->scene == SCENE_GRID ? GRID_SIZE * GRID_SIZE : 1;
+	uint64_t triangles = draws;
+	if (renderer->mesh_enabled) {
+		draws = 0;
+		for (uint32_t i = 0; i < renderer->mesh_lod_count; i++) {
+			draws += renderer->mesh_lod_histogram[i];
+		}
+		triangles = renderer->mesh_triangles;
+	}
+	double samples = (double) renderer->stats_samples;
+	struct StatsSnapshot* stats = &renderer->stats;
+	*stats = (struct StatsSnapshot) {
+		.uptime = frame_start - renderer->launch_time,
+		.frames = renderer->frame_index,
+		.frame_time = frame_history_summary(&renderer->frame_history),
+		.cpu_ms = renderer->stats_cpu_total / samples * 1000.0,
+		.acquire_ms = renderer->stats_acquire_total / samples * 1000.0,
+		.present_ms = renderer->stats_present_total / samples * 1000.0,
+		.draws = draws,
+		.triangles = triangles,
+		.has_pipeline_statistics = renderer->has_pipeline_statistics,
+		.pipeline = renderer->pipeline_statistics,
+		.heap_count = renderer->memory.heap_count,
+		.headless = renderer->headless,
+		.present_mode = renderer->present_mode,
+		.image_count = renderer->swap_chain_image_count,
+		.width = renderer->swap_chain_extent.width,
+		.height = renderer->swap_chain_extent.height,
+		.presents = renderer->presents,
+		.present_errors = renderer->present_errors,
+	};
+	memcpy(stats->heap_used, renderer->memory.heap_used, sizeof(stats->heap_used));
+	memcpy(stats->heap_sizes, renderer->memory.heap_sizes, sizeof(stats->heap_sizes));
+	memcpy(stats->heap_device_local, renderer->memory.heap_device_local, sizeof(stats->heap_device_local));
+	renderer->stats_cpu_total = 0.0;
+	renderer->stats_acquire_total = 0.0;
+	renderer->stats_present_total = 0.0;
+	renderer->stats_samples = 0;
+	renderer->stats_time = frame_start;
+
+	format_overlay_text(stats, renderer->overlay_text, sizeof(renderer->overlay_text));
+	if (renderer->metrics_enabled) {
+		char text[METRICS_TEXT_SIZE];
+		size_t length = format_metrics(stats, text, sizeof(text));
+		metrics_server_publish(&renderer->metrics, text, length);
+	}
+}
+
+// Called on the render thread with the newest packet from the input thread.
+void apply_frame_packet(struct Renderer* renderer, const struct FramePacket* packet) {
+	if (packet->scene != renderer->scene) {
+		renderer->scene = packet->scene;
+		mark_commands_dirty(renderer);
+	}
+	// the first switch to a feature set builds its variant here, later ones only rebind
+	if (packet->shader_features != renderer->shader_features && select_pipeline(renderer, packet->shader_features)) {
+		mark_commands_dirty(renderer);
+	}
+	if (packet->overlay != renderer->overlay_enabled && renderer->overlay_available) {
+		renderer->overlay_enabled = packet->overlay;
+		mark_commands_dirty(renderer);
+	}
+	// packets the render thread skipped are folded into this one, so latency is
+	// measured from the newest input only
+	if (packet->input_time > renderer->newest_input_time) {
+		renderer->newest_input_time = packet->input_time;
+		renderer->pending_input_time = packet->input_time;
+	}
+}
+
+// Takes the input-to-photon sample of a frame the GPU has finished.
+void collect_input_latency(struct Renderer* renderer, struct FrameSlot* frame) {
+	if (frame->input_time > 0.0) {
+		double latency = now_seconds() - frame->input_time;
+		renderer->latency_total += latency;
+		renderer->latency_samples++;
+		if (latency > renderer->latency_max) {
+			renderer->latency_max = latency;
+		}
+		frame->input_time = 0.0;
+	}
+}
+
 void draw_frame(struct Renderer* renderer) {
-	vkWaitForFences(renderer->logical_device, 1, &renderer->in_flight_fence, VK_TRUE, UINT64_MAX);
-	vkResetFences(renderer->logical_device, 1, &renderer->in_flight_fence);
+	double frame_start = now_seconds();
+	// a slot is only waited on when it comes around again, so poll the others
+	// for finished frames to keep the latency samples close to completion
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		struct FrameSlot* other = &renderer->frames[i];
+		if (other->input_time > 0.0 && vkGetFenceStatus(renderer->logical_device, other->in_flight_fence) == VK_SUCCESS) {
+			collect_input_latency(renderer, other);
+		}
+	}
+	uint32_t slot = renderer->frame_index % FRAMES_IN_FLIGHT;
+	struct FrameSlot* frame = &renderer->frames[slot];
+	vkWaitForFences(renderer->logical_device, 1, &frame->in_flight_fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(renderer->logical_device, 1, &frame->in_flight_fence);
+	collect_input_latency(renderer, frame);
+	// only the CPU reads the arena, so it can go at once even with the other frame in flight
+	arena_reset(&renderer->frame_arena);
+	if (frame->statistics_pending) {
+		// the counters in flag order followed by the availability word; the fence
+		// above means the query has its results, so this does not wait
+		uint32_t count = sizeof(struct PipelineStatistics) / sizeof(uint64_t) + 1;
+		uint64_t* results = ARENA_ARRAY(&renderer->frame_arena, uint64_t, count);
+		VkResult result = results ? vkGetQueryPoolResults(renderer->logical_device, renderer->statistics_pool, slot, 1,
+			count * sizeof(uint64_t), results, count * sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) : VK_ERROR_OUT_OF_HOST_MEMORY;
+		renderer->has_pipeline_statistics = result == VK_SUCCESS && results[count - 1] != 0;
+		if (renderer->has_pipeline_statistics) {
+			memcpy(&renderer->pipeline_statistics, results, sizeof(renderer->pipeline_statistics));
+		}
+		frame->statistics_pending = false;
+	}
+	if (frame->readback) {
+		hand_off_readback(renderer, frame->readback);
+		frame->readback = NULL;
+	}
 	
 	uint32_t image_index;
-	vkAcquireNextImageKHR
-		(renderer->logical_device, renderer->swap_chain, UINT64_MAX, renderer->image_available_semaphore, VK_NULL_HANDLE, &image_index);
-	vkResetCommandBuffer(renderer->command_buffer, 0);
-	record_command_buffer(renderer, image_index);
+	if (renderer->headless) {
+		// offscreen images are used round robin, the fence above retired the last use of this one
+		image_index = renderer->frame_index % renderer->swap_chain_image_count;
+	} else {
+		double acquire_start = now_seconds();
+		vkAcquireNextImageKHR(renderer->logical_device, renderer->swap_chain, UINT64_MAX,
+			frame->image_available_semaphore, VK_NULL_HANDLE, &image_index);
+		renderer->stats_acquire_total += now_seconds() - acquire_start;
+	}
+
+	// CPU cost of preparing and submitting the frame, without the blocking waits
+	double cpu_start = now_seconds();
+	if (renderer->mesh_enabled) {
+		// the fence above also retired this slot's uniform region
+		uniform_ring_begin_frame(&renderer->uniforms, slot);
+		update_mesh_instances(renderer);
+	}
+	if (renderer->overlay_enabled) {
+		update_overlay(renderer, slot);
+	}
+	VkCommandBuffer command_buffer = frame->command_buffer;
+	struct ReadbackSlot* readback = NULL;
+	if (renderer->exporting || (renderer->capture_next_frame && renderer->readback_enabled)) {
+		readback = acquire_readback_slot(renderer);
+		renderer->capture_next_frame = false;
+	}
+	if (renderer->static_commands && !readback) {
+		if (frame->commands_dirty) {
+			// the fence above retired the last submit of this slot, none of these are pending
+			record_static_command_buffers(renderer, frame);
+		}
+		command_buffer = frame->image_command_buffers[image_index];
+	} else {
+		vkResetCommandBuffer(command_buffer, 0);
+		record_command_buffer(renderer, command_buffer, image_index, slot, readback);
+	}
+	frame->readback = readback;
+	renderer->last_readback = readback;
+	if (renderer->mesh_enabled) {
+		uniform_ring_flush(&renderer->uniforms);
+	}
+	if (renderer->overlay_enabled) {
+		uniform_ring_flush(&renderer->overlay_ring);
+	}
 
 	VkSubmitInfo submit_info = {};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore wait_semaphores[] = {renderer->image_available_semaphore};
+	VkSemaphore wait_semaphores[] = {frame->image_available_semaphore};
 	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submit_info.waitSemaphoreCount = 1;
+	submit_info.waitSemaphoreCount = renderer->headless ? 0 : 1;
 	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.pWaitDstStageMask = wait_stages;
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &renderer->command_buffer;
+	submit_info.pCommandBuffers = &command_buffer;
 
-	VkSemaphore signal[] = {renderer->render_finished_semaphore};
-	submit_info.signalSemaphoreCount = 1;
+	VkSemaphore signal[] = {frame->render_finished_semaphore};
+	submit_info.signalSemaphoreCount = renderer->headless ? 0 : 1;
 	submit_info.pSignalSemaphores = signal;
 
-	if (vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, renderer->in_flight_fence) != VK_SUCCESS) {
+	if (vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, frame->in_flight_fence) != VK_SUCCESS) {
 		printf("Failed to submit work.\n");
 	}
+	frame->input_time = renderer->pending_input_time;
+	frame->statistics_pending = renderer->statistics_pool != VK_NULL_HANDLE;
+	renderer->pending_input_time = 0.0;
+	double cpu_time = now_seconds() - cpu_start;
+	report_cpu_frame_time(renderer, cpu_time);
+	renderer->frame_index++;
+	update_stats(renderer, frame_start, cpu_time);
+	if (renderer->headless) {
+		return;
+	}
 
 	VkPresentInfoKHR present_info = {};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -162,7 +1389,18 @@ void draw_frame(struct Renderer* renderer) {
 	present_info.pImageIndices = &image_index;
 
 	present_info.pResults = NULL;
-	vkQueuePresentKHR(renderer->present_queue, &present_info);
+	double present_start = now_seconds();
+	VkResult present_result = vkQueuePresentKHR(renderer->present_queue, &present_info);
+	renderer->stats_present_total += now_seconds() - present_start;
+	renderer->presents++;
+	if (present_result != VK_SUCCESS) {
+		renderer->present_errors++;
+	}
+
+	if (!renderer->presented) {
+		renderer->presented = true;
+		printf("Time to first present: %.1f ms\n", (now_seconds() - renderer->launch_time) * 1000.0);
+	}
 }
 
 
@@ -171,28 +1409,288 @@ void create_command_buffer(struct Renderer* renderer) {
 	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	alloc_info.commandPool = renderer->command_pool;
 	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	alloc_info.commandBufferCount = 1;
 
-	VkResult result = vkAllocateCommandBuffers(renderer->logical_device, &alloc_info, &renderer->command_buffer);
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		struct FrameSlot* frame = &renderer->frames[i];
+		alloc_info.commandBufferCount = 1;
+		VkResult result = vkAllocateCommandBuffers(renderer->logical_device, &alloc_info, &frame->command_buffer);
+		if (result != VK_SUCCESS) {
+			printf("Failed to create command buffer. code: %d\n", result);
+		}
+
+		if (renderer->static_commands) {
+			frame->image_command_buffers = heap_alloc(sizeof(VkCommandBuffer) * renderer->swap_chain_image_count);
+			alloc_info.commandBufferCount = renderer->swap_chain_image_count;
+			result = vkAllocateCommandBuffers(renderer->logical_device, &alloc_info, frame->image_command_buffers);
+			if (result != VK_SUCCESS) {
+				printf("Failed to create static command buffers. code: %d\n", result);
+			}
+			frame->commands_dirty = true;
+		}
+	}
+}
+
+// Returns UINT32_MAX when no memory type has all the required properties.
+uint32_t find_memory_type(struct Renderer* renderer, uint32_t type_bits, VkMemoryPropertyFlags properties) {
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(renderer->physical_device, &memory_properties);
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+		if ((type_bits & (1u << i)) && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
+// Every device allocation goes through these two, so memory use per heap can be reported.
+VkResult allocate_memory(struct Renderer* renderer, const VkMemoryAllocateInfo* info, VkDeviceMemory* memory) {
+	VkResult result = vkAllocateMemory(renderer->logical_device, info, NULL, memory);
+	if (result == VK_SUCCESS) {
+		memory_tracker_add(&renderer->memory, *memory, info->memoryTypeIndex, info->allocationSize);
+	}
+	return result;
+}
 
+void free_memory(struct Renderer* renderer, VkDeviceMemory memory) {
+	memory_tracker_remove(&renderer->memory, memory);
+	vkFreeMemory(renderer->logical_device, memory, NULL);
+}
+
+// Creates a buffer with its own allocation. The first of the property sets
+// that a memory type satisfies is used, pass the same set twice for no fallback.
+bool create_buffer(struct Renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags preferred, VkMemoryPropertyFlags required,
+	VkBuffer* buffer, VkDeviceMemory* memory, VkMemoryPropertyFlags* chosen) {
+	VkBufferCreateInfo buffer_info = {};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.size = size;
+	buffer_info.usage = usage;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult result = vkCreateBuffer(renderer->logical_device, &buffer_info, NULL, buffer);
 	if (result != VK_SUCCESS) {
-		printf("Failed to create command buffer. code: %d\n", result);
+		printf("Failed to create buffer. Error code: %d\n", result);
+		return false;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(renderer->logical_device, *buffer, &requirements);
+	VkMemoryPropertyFlags properties = preferred;
+	uint32_t type = find_memory_type(renderer, requirements.memoryTypeBits, preferred);
+	if (type == UINT32_MAX) {
+		properties = required;
+		type = find_memory_type(renderer, requirements.memoryTypeBits, required);
+	}
+	if (type == UINT32_MAX) {
+		printf("Failed to find a memory type for buffer.\n");
+		vkDestroyBuffer(renderer->logical_device, *buffer, NULL);
+		*buffer = VK_NULL_HANDLE;
+		return false;
 	}
 
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = requirements.size;
+	alloc_info.memoryTypeIndex = type;
+	result = allocate_memory(renderer, &alloc_info, memory);
+	if (result != VK_SUCCESS) {
+		printf("Failed to allocate buffer memory. Error code: %d\n", result);
+		vkDestroyBuffer(renderer->logical_device, *buffer, NULL);
+		*buffer = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindBufferMemory(renderer->logical_device, *buffer, *memory, 0);
+	if (chosen) {
+		*chosen = properties;
+	}
+	return true;
+}
 
+void destroy_buffer(struct Renderer* renderer, VkBuffer buffer, VkDeviceMemory memory) {
+	vkDestroyBuffer(renderer->logical_device, buffer, NULL);
+	free_memory(renderer, memory);
+}
+
+// Host-cached memory keeps the writer thread's reads of the mapped frames fast.
+bool create_readback_ring(struct Renderer* renderer) {
+	VkDeviceSize size = (VkDeviceSize) renderer->swap_chain_extent.width * renderer->swap_chain_extent.height * 4;
+	for (uint32_t i = 0; i < READBACK_RING_SIZE; i++) {
+		struct ReadbackSlot* slot = &renderer->readback_slots[i];
+		atomic_init(&slot->busy, 0);
+		VkMemoryPropertyFlags properties = 0;
+		if (!create_buffer(renderer, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+			&slot->buffer, &slot->memory, &properties)) {
+			return false;
+		}
+		slot->coherent = (properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+		VkResult result = vkMapMemory(renderer->logical_device, slot->memory, 0, VK_WHOLE_SIZE, 0, &slot->mapped);
+		if (result != VK_SUCCESS) {
+			printf("Failed to map the readback buffer. Error code: %d\n", result);
+			// destroy_readback_ring() unmaps every slot with a buffer, this one never got mapped
+			destroy_buffer(renderer, slot->buffer, slot->memory);
+			slot->buffer = VK_NULL_HANDLE;
+			slot->memory = VK_NULL_HANDLE;
+			slot->mapped = NULL;
+			return false;
+		}
+	}
+	printf("Readback ring ready: %d x %lu bytes.\n", READBACK_RING_SIZE, (unsigned long) size);
+	return true;
+}
+
+void destroy_readback_ring(struct Renderer* renderer) {
+	for (uint32_t i = 0; i < READBACK_RING_SIZE; i++) {
+		struct ReadbackSlot* slot = &renderer->readback_slots[i];
+		if (slot->buffer != VK_NULL_HANDLE) {
+			vkUnmapMemory(renderer->logical_device, slot->memory);
+			destroy_buffer(renderer, slot->buffer, slot->memory);
+		}
+	}
+}
+
+// One region per frame in flight, each with room for the camera block and an
+// object block per instance of the largest scene. Memory the GPU reads fast
+// is preferred, any host-visible memory will do.
+bool create_uniform_ring(struct Renderer* renderer) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+	VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+	VkDeviceSize atom_size = properties.limits.nonCoherentAtomSize;
+	// every block is padded to the aligned size of the larger one
+	VkDeviceSize largest = sizeof(struct CameraUniforms) > sizeof(struct ObjectUniforms) ?
+		sizeof(struct CameraUniforms) : sizeof(struct ObjectUniforms);
+	VkDeviceSize block = (largest + alignment - 1) / alignment * alignment;
+	VkDeviceSize region_size = block * (1 + FIELD_SIZE * FIELD_SIZE);
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkMemoryPropertyFlags chosen = 0;
+	if (!create_buffer(renderer, uniform_ring_buffer_size(region_size, FRAMES_IN_FLIGHT, alignment, atom_size),
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		&buffer, &memory, &chosen)) {
+		return false;
+	}
+	if (!uniform_ring_init(&renderer->uniforms, renderer->logical_device, buffer, memory,
+		(chosen & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0, region_size, FRAMES_IN_FLIGHT, alignment, atom_size)) {
+		destroy_buffer(renderer, buffer, memory);
+		renderer->uniforms.buffer = VK_NULL_HANDLE;
+		return false;
+	}
+
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		.descriptorCount = 2,
+	};
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.maxSets = 1;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &pool_size;
+	VkResult result = vkCreateDescriptorPool(renderer->logical_device, &pool_info, NULL, &renderer->descriptor_pool);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create descriptor pool. Error code: %d\n", result);
+		return false;
+	}
+	VkDescriptorSetAllocateInfo set_info = {};
+	set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	set_info.descriptorPool = renderer->descriptor_pool;
+	set_info.descriptorSetCount = 1;
+	set_info.pSetLayouts = &renderer->descriptor_set_layout;
+	result = vkAllocateDescriptorSets(renderer->logical_device, &set_info, &renderer->descriptor_set);
+	if (result != VK_SUCCESS) {
+		printf("Failed to allocate descriptor set. Error code: %d\n", result);
+		return false;
+	}
+
+	// written once, the dynamic offsets pick the blocks of each draw
+	VkDescriptorBufferInfo blocks[] = {
+		{.buffer = buffer, .offset = 0, .range = sizeof(struct CameraUniforms)},
+		{.buffer = buffer, .offset = 0, .range = sizeof(struct ObjectUniforms)},
+	};
+	VkWriteDescriptorSet writes[2] = {};
+	for (uint32_t i = 0; i < 2; i++) {
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = renderer->descriptor_set;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		writes[i].pBufferInfo = &blocks[i];
+	}
+	vkUpdateDescriptorSets(renderer->logical_device, 2, writes, 0, NULL);
+	printf("Uniform ring ready: %d x %lu bytes, %s.\n", FRAMES_IN_FLIGHT, (unsigned long) renderer->uniforms.region_size,
+		renderer->uniforms.coherent ? "coherent" : "flushed per frame");
+	return true;
+}
+
+void destroy_uniform_ring(struct Renderer* renderer) {
+	vkDestroyDescriptorPool(renderer->logical_device, renderer->descriptor_pool, NULL);
+	vkDestroyDescriptorSetLayout(renderer->logical_device, renderer->descriptor_set_layout, NULL);
+	if (renderer->uniforms.buffer != VK_NULL_HANDLE) {
+		uniform_ring_destroy(&renderer->uniforms);
+		destroy_buffer(renderer, renderer->uniforms.buffer, renderer->uniforms.memory);
+	}
+}
+
+// Host-visible like the uniform ring, and read by the draw itself through the
+// indirect command at the start of each region.
+bool create_overlay_ring(struct Renderer* renderer) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+	// draw commands need 4 byte alignment, vertices start right after one
+	VkDeviceSize alignment = sizeof(VkDrawIndirectCommand);
+	VkDeviceSize atom_size = properties.limits.nonCoherentAtomSize;
+	VkDeviceSize region_size = sizeof(VkDrawIndirectCommand) + OVERLAY_MAX_VERTICES * sizeof(struct OverlayVertex);
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkMemoryPropertyFlags chosen = 0;
+	if (!create_buffer(renderer, uniform_ring_buffer_size(region_size, FRAMES_IN_FLIGHT, alignment, atom_size),
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		&buffer, &memory, &chosen)) {
+		return false;
+	}
+	if (!uniform_ring_init(&renderer->overlay_ring, renderer->logical_device, buffer, memory,
+		(chosen & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0, region_size, FRAMES_IN_FLIGHT, alignment, atom_size)) {
+		destroy_buffer(renderer, buffer, memory);
+		renderer->overlay_ring.buffer = VK_NULL_HANDLE;
+		return false;
+	}
+	return true;
+}
+
+void destroy_overlay(struct Renderer* renderer) {
+	vkDestroyPipeline(renderer->logical_device, renderer->overlay_pipeline, NULL);
+	vkDestroyPipelineLayout(renderer->logical_device, renderer->overlay_layout, NULL);
+	if (renderer->overlay_ring.buffer != VK_NULL_HANDLE) {
+		uniform_ring_destroy(&renderer->overlay_ring);
+		destroy_buffer(renderer, renderer->overlay_ring.buffer, renderer->overlay_ring.memory);
+	}
 }
 
 void create_frame_buffers(struct Renderer* renderer) {
-	renderer->swapchain_frame_buffers = malloc(renderer->swap_chain_image_count);
+	renderer->swapchain_frame_buffers = heap_alloc(sizeof(VkFramebuffer) * renderer->swap_chain_image_count);
 
 	for (int i = 0; i < renderer->swap_chain_image_count; i++) {
-		VkImageView attachments[] = {
-			renderer->swap_chain_image_views[i],
-		};
+		// one depth buffer and multisampled image serve every image, frames in
+		// flight are ordered by the subpass dependency; same order as create_render_pass()
+		VkImageView attachments[3];
+		uint32_t attachment_count = 0;
+		bool multisampled = renderer->samples != VK_SAMPLE_COUNT_1_BIT;
+		attachments[attachment_count++] = multisampled ? renderer->color_view : renderer->swap_chain_image_views[i];
+		if (renderer->mesh_enabled) {
+			attachments[attachment_count++] = renderer->depth_view;
+		}
+		if (multisampled) {
+			attachments[attachment_count++] = renderer->swap_chain_image_views[i];
+		}
 		VkFramebufferCreateInfo frame_buffer_info = {};
 		frame_buffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		frame_buffer_info.renderPass = renderer->render_pass;
-		frame_buffer_info.attachmentCount = 1;
+		frame_buffer_info.attachmentCount = attachment_count;
 		frame_buffer_info.pAttachments = attachments;
 		frame_buffer_info.width = renderer->swap_chain_extent.width;
 		frame_buffer_info.height = renderer->swap_chain_extent.height;
@@ -206,7 +1704,13 @@ void create_frame_buffers(struct Renderer* renderer) {
 	}
 }
 
+// Attachments in order: colour, depth with --mesh, and with --msaa the
+// swapchain image the multisampled colour resolves into.
 void create_render_pass(struct Renderer* renderer) {
+	bool multisampled = renderer->samples != VK_SAMPLE_COUNT_1_BIT;
+	VkAttachmentDescription attachments[3];
+	uint32_t attachment_count = 0;
+
 	VkAttachmentDescription color_attachment = {};
 	color_attachment.format = renderer->swap_chain_image_format;
 	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -217,29 +1721,68 @@ void create_render_pass(struct Renderer* renderer) {
 	color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
 	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	color_attachment.finalLayout = renderer->final_layout;
+
+	VkAttachmentReference resolve_attachment_ref = {};
+	resolve_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	VkAttachmentDescription resolve_attachment = color_attachment;
+	if (multisampled) {
+		// the samples only live until the resolve at the end of the subpass
+		color_attachment.samples = renderer->samples;
+		color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		resolve_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	}
 
 	VkAttachmentReference color_attachment_ref = {};
-	color_attachment_ref.attachment = 0;
+	color_attachment_ref.attachment = attachment_count;
 	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[attachment_count++] = color_attachment;
+
+	// the depth buffer is cleared every frame and never read afterwards
+	VkAttachmentDescription depth_attachment = {};
+	depth_attachment.format = renderer->depth_format;
+	depth_attachment.samples = renderer->samples;
+	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depth_attachment_ref = {};
+	depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	if (renderer->mesh_enabled) {
+		depth_attachment_ref.attachment = attachment_count;
+		attachments[attachment_count++] = depth_attachment;
+	}
+	if (multisampled) {
+		resolve_attachment_ref.attachment = attachment_count;
+		attachments[attachment_count++] = resolve_attachment;
+	}
 
 	VkSubpassDescription subpass = {};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &color_attachment_ref;
+	subpass.pResolveAttachments = multisampled ? &resolve_attachment_ref : NULL;
+	subpass.pDepthStencilAttachment = renderer->mesh_enabled ? &depth_attachment_ref : NULL;
 
 	VkSubpassDependency dep = {};
 	dep.srcSubpass = VK_SUBPASS_EXTERNAL;
 	dep.dstSubpass = 0;
-	dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dep.srcAccessMask = 0;
-	dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	// the depth buffer and multisampled image are shared by all frames, so their writes must finish first
+	dep.srcAccessMask = (renderer->mesh_enabled ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0) |
+		(multisampled ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0);
+	dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		(renderer->mesh_enabled ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0);
 
 	VkRenderPassCreateInfo render_pass_info = {};
 	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	render_pass_info.attachmentCount = 1;
-	render_pass_info.pAttachments = &color_attachment;
+	render_pass_info.attachmentCount = attachment_count;
+	render_pass_info.pAttachments = attachments;
 	render_pass_info.subpassCount = 1;
 	render_pass_info.pSubpasses = &subpass;
 	render_pass_info.dependencyCount = 1;
@@ -266,150 +1809,279 @@ VkShaderModule create_shader_module(VkDevice device, char* code, uint32_t size)
 
 }
 
-void create_graphics_pipeline(struct Renderer* renderer) {
-	long vshader_size;
-	long fshader_size;
-	char* vshader_code = read_file("shaders/vert.spv", &vshader_size);
-	char* fshader_code = read_file("shaders/frag.spv", &fshader_size);
-	VkShaderModule vert_shader_module = create_shader_module(renderer->logical_device, vshader_code, vshader_size);
-	VkShaderModule frag_shader_module = create_shader_module(renderer->logical_device, fshader_code, fshader_size);
-	
-	VkPipelineShaderStageCreateInfo vert_shader_stage_info = {};
-	vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vert_shader_stage_info.pSpecializationInfo = NULL;
-	vert_shader_stage_info.module = vert_shader_module;
-	vert_shader_stage_info.pName = "main";
+void* load_pipeline_sources_task(void* arg) {
+	struct PipelineSources* sources = arg;
+	// the mesh shader reads quantized vertex attributes, the triangle shader none
+	sources->vshader_code = read_file(sources->mesh_path ? "shaders/mesh_vert.spv" : "shaders/vert.spv",
+		&sources->vshader_size);
+	sources->fshader_code = read_file("shaders/frag.spv", &sources->fshader_size);
+	// optional, without them the overlay is unavailable
+	sources->overlay_vshader_code = read_file("shaders/overlay_vert.spv", &sources->overlay_vshader_size);
+	sources->overlay_fshader_code = read_file("shaders/overlay_frag.spv", &sources->overlay_fshader_size);
+	sources->cache_data = read_file(PIPELINE_CACHE_FILE, &sources->cache_size);
+	if (!sources->vshader_code || !sources->fshader_code) {
+		printf("Failed to read shader binaries.\n");
+	}
+	if (sources->mesh_path) {
+		mesh_map(sources->mesh_path, &sources->mesh);
+	}
+	return NULL;
+}
 
-	VkPipelineShaderStageCreateInfo frag_shader_stage_info = {};
-	frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	frag_shader_stage_info.pSpecializationInfo = NULL;
-	frag_shader_stage_info.module = frag_shader_module;
-	frag_shader_stage_info.pName = "main";
-	
-	VkPipelineShaderStageCreateInfo stages[] = {vert_shader_stage_info, frag_shader_stage_info};
+// Frees whatever the consumers of the files have not taken, all of it when
+// startup stops before the pipeline is compiled. Safe to call again.
+void release_pipeline_sources(struct PipelineSources* sources) {
+	heap_free(sources->vshader_code);
+	heap_free(sources->fshader_code);
+	heap_free(sources->overlay_vshader_code);
+	heap_free(sources->overlay_fshader_code);
+	heap_free(sources->cache_data);
+	sources->vshader_code = NULL;
+	sources->fshader_code = NULL;
+	sources->overlay_vshader_code = NULL;
+	sources->overlay_fshader_code = NULL;
+	sources->cache_data = NULL;
+	mesh_unmap(&sources->mesh);
+}
+
+void create_pipeline_cache(struct Renderer* renderer, struct PipelineSources* sources) {
+	VkPipelineCacheCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	// the driver validates the header and ignores data written by another device or driver version
+	info.initialDataSize = sources->cache_data ? sources->cache_size : 0;
+	info.pInitialData = sources->cache_data;
+
+	VkResult result = vkCreatePipelineCache(renderer->logical_device, &info, NULL, &renderer->pipeline_cache);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create pipeline cache. Error code: %d\n", result);
+		renderer->pipeline_cache = VK_NULL_HANDLE;
+	}
+	heap_free(sources->cache_data);
+	sources->cache_data = NULL;
+}
+
+void save_pipeline_cache(struct Renderer* renderer) {
+	if (renderer->pipeline_cache == VK_NULL_HANDLE) {
+		return;
+	}
+	size_t size = 0;
+	vkGetPipelineCacheData(renderer->logical_device, renderer->pipeline_cache, &size, NULL);
+	if (size == 0) {
+		return;
+	}
+	char* data = heap_alloc(size);
+	if (vkGetPipelineCacheData(renderer->logical_device, renderer->pipeline_cache, &size, data) == VK_SUCCESS) {
+		FILE* fp = fopen(PIPELINE_CACHE_FILE, "wb");
+		if (fp != NULL) {
+			fwrite(data, size, 1, fp);
+			fclose(fp);
+		}
+	}
+	heap_free(data);
+}
+
+// The modules stay alive for the whole run, new variants are built from them on demand.
+bool create_shader_modules(struct Renderer* renderer, struct PipelineSources* sources) {
+	if (!sources->vshader_code || !sources->fshader_code) {
+		printf("Failed to create graphics pipeline. Missing shader code.\n");
+		return false;
+	}
+	renderer->vertex_shader = create_shader_module(renderer->logical_device, sources->vshader_code, sources->vshader_size);
+	renderer->fragment_shader = create_shader_module(renderer->logical_device, sources->fshader_code, sources->fshader_size);
+	heap_free(sources->vshader_code);
+	heap_free(sources->fshader_code);
+	sources->vshader_code = NULL;
+	sources->fshader_code = NULL;
+	return renderer->vertex_shader != VK_NULL_HANDLE && renderer->fragment_shader != VK_NULL_HANDLE;
+}
 
+void create_pipeline_layout(struct Renderer* renderer) {
+	VkPushConstantRange mesh_constants = {
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = sizeof(struct MeshConstants),
+	};
+	// camera and object blocks, both in the uniform ring and bound at a new offset per draw
+	VkDescriptorSetLayoutBinding uniform_bindings[] = {
+		{.binding = 0, .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT},
+		{.binding = 1, .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT},
+	};
+	VkResult result = VK_SUCCESS;
+	if (renderer->mesh_enabled) {
+		VkDescriptorSetLayoutCreateInfo set_layout = {};
+		set_layout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		set_layout.bindingCount = 2;
+		set_layout.pBindings = uniform_bindings;
+		result = vkCreateDescriptorSetLayout(renderer->logical_device, &set_layout, NULL, &renderer->descriptor_set_layout);
+		if (result != VK_SUCCESS) {
+			printf("Failed to create descriptor set layout. Error code: %d\n", result);
+		}
+	}
+	VkPipelineLayoutCreateInfo pipeline_layout = {};
+	pipeline_layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout.setLayoutCount = renderer->mesh_enabled ? 1 : 0;
+	pipeline_layout.pSetLayouts = &renderer->descriptor_set_layout;
+	pipeline_layout.pushConstantRangeCount = renderer->mesh_enabled ? 1 : 0;
+	pipeline_layout.pPushConstantRanges = &mesh_constants;
+	result = vkCreatePipelineLayout(renderer->logical_device, &pipeline_layout, NULL, &renderer->pipeline_layout);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create pipeline layout. Error code: %d\n", result);
+	}
+}
+
+// Alpha blended over the scene in the same subpass, so it matches the scene's
+// sample count and leaves the depth buffer alone.
+bool create_overlay_pipeline(struct Renderer* renderer, struct PipelineSources* sources) {
+	if (!sources->overlay_vshader_code || !sources->overlay_fshader_code) {
+		return false;
+	}
+	VkShaderModule vertex_shader = create_shader_module(renderer->logical_device, sources->overlay_vshader_code,
+		sources->overlay_vshader_size);
+	VkShaderModule fragment_shader = create_shader_module(renderer->logical_device, sources->overlay_fshader_code,
+		sources->overlay_fshader_size);
+	heap_free(sources->overlay_vshader_code);
+	heap_free(sources->overlay_fshader_code);
+	sources->overlay_vshader_code = NULL;
+	sources->overlay_fshader_code = NULL;
+
+	VkPipelineShaderStageCreateInfo stages[2] = {};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = vertex_shader;
+	stages[0].pName = "main";
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = fragment_shader;
+	stages[1].pName = "main";
+
+	VkVertexInputBindingDescription binding = {
+		.binding = 0,
+		.stride = sizeof(struct OverlayVertex),
+		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+	};
+	VkVertexInputAttributeDescription attributes[] = {
+		{.location = 0, .binding = 0, .format = VK_FORMAT_R16G16_UINT, .offset = offsetof(struct OverlayVertex, x)},
+		{.location = 1, .binding = 0, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = offsetof(struct OverlayVertex, color)},
+	};
 	VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
 	vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertex_input_info.vertexBindingDescriptionCount = 0;
-	vertex_input_info.pVertexBindingDescriptions = NULL;
-	vertex_input_info.vertexAttributeDescriptionCount = 0;
-	vertex_input_info.pVertexAttributeDescriptions = NULL;
+	vertex_input_info.vertexBindingDescriptionCount = 1;
+	vertex_input_info.pVertexBindingDescriptions = &binding;
+	vertex_input_info.vertexAttributeDescriptionCount = 2;
+	vertex_input_info.pVertexAttributeDescriptions = attributes;
 
 	VkPipelineInputAssemblyStateCreateInfo assembly_info = {};
 	assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	assembly_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	assembly_info.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = renderer->swap_chain_extent.width;
-	viewport.height = renderer->swap_chain_extent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor = {
-		.offset = {0, 0},
-		.extent = renderer->swap_chain_extent,
-	};
+	VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	VkPipelineDynamicStateCreateInfo dynamic_state = {};
+	dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state.dynamicStateCount = 2;
+	dynamic_state.pDynamicStates = dynamic_states;
 
 	VkPipelineViewportStateCreateInfo viewport_state = {};
 	viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewport_state.viewportCount = 1;
-	viewport_state.pViewports = &viewport;
 	viewport_state.scissorCount = 1;
-	viewport_state.pScissors = &scissor;
 
 	VkPipelineRasterizationStateCreateInfo rasterizer = {};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
 	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
 	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
 	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
-	rasterizer.depthBiasConstantFactor = 0.0f;
-	rasterizer.depthBiasClamp = 0.0f;
-	rasterizer.depthBiasSlopeFactor = 0.0f;
 
 	VkPipelineMultisampleStateCreateInfo multisampling = {};
 	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.rasterizationSamples = renderer->samples;
 	multisampling.minSampleShading = 1.0f;
-	multisampling.pSampleMask = NULL;
-	multisampling.alphaToCoverageEnable = VK_FALSE;
-	multisampling.alphaToOneEnable = VK_FALSE;
 
 	VkPipelineColorBlendAttachmentState color_blend_attachment = {};
-	color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT 
+	color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
 		| VK_COLOR_COMPONENT_G_BIT
 		| VK_COLOR_COMPONENT_B_BIT
 		| VK_COLOR_COMPONENT_A_BIT;
-	color_blend_attachment.blendEnable = VK_FALSE;
-	color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-	color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-	color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-	color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-	color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-	color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
-	
-	VkPipelineColorBlendStateCreateInfo color_bleding = {};
-	color_bleding.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	color_bleding.logicOpEnable = VK_FALSE;
-	color_bleding.logicOp = VK_LOGIC_OP_COPY;
-	color_bleding.attachmentCount = 1;
-	color_bleding.pAttachments = &color_blend_attachment;
-	color_bleding.blendConstants[0] = 0.0f;
-	color_bleding.blendConstants[1] = 0.0f;
-	color_bleding.blendConstants[2] = 0.0f;
-	color_bleding.blendConstants[3] = 0.0f;
-
-	VkPipelineLayoutCreateInfo pipeline_layout = {};
-	pipeline_layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_layout.setLayoutCount = 0; // Optional
-	pipeline_layout.pSetLayouts = NULL; // Optional
-	pipeline_layout.pushConstantRangeCount = 0; // Optional
-	pipeline_layout.pPushConstantRanges = NULL; // Optional
-	VkResult result = vkCreatePipelineLayout(renderer->logical_device, &pipeline_layout, NULL, &renderer->pipeline_layout);
+	color_blend_attachment.blendEnable = VK_TRUE;
+	color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+	color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo color_blending = {};
+	color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	color_blending.attachmentCount = 1;
+	color_blending.pAttachments = &color_blend_attachment;
+
+	// on top of everything, without touching the depth the scene wrote
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = VK_FALSE;
+	depth_stencil.depthWriteEnable = VK_FALSE;
+
+	VkPushConstantRange pixel_scale = {
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = 2 * sizeof(float),
+	};
+	VkPipelineLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &pixel_scale;
+	VkResult result = vkCreatePipelineLayout(renderer->logical_device, &layout_info, NULL, &renderer->overlay_layout);
 	if (result != VK_SUCCESS) {
-		printf("Failed to create pipeline layout. Error code: %d\n", result);
-	}
-
-	VkGraphicsPipelineCreateInfo pipeline_info = {};
-	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipeline_info.stageCount = 2;
-	pipeline_info.pStages = stages;
-	// stages
-	pipeline_info.pVertexInputState = &vertex_input_info;
-	pipeline_info.pInputAssemblyState = &assembly_info;
-	pipeline_info.pViewportState = &viewport_state;
-	pipeline_info.pRasterizationState = &rasterizer;
-	pipeline_info.pMultisampleState = &multisampling;
-	pipeline_info.pDepthStencilState = NULL;
-	pipeline_info.pColorBlendState = &color_bleding;
-	pipeline_info.pDynamicState = NULL;
-	pipeline_info.layout = renderer->pipeline_layout;
-	pipeline_info.renderPass = renderer->render_pass;
-	pipeline_info.subpass = 0;
-	pipeline_info.basePipelineIndex = -1;
-	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-	
-	VkResult pipeline_result = 
-		vkCreateGraphicsPipelines(renderer->logical_device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &renderer->graphics_pipeline);
-	if (pipeline_result != VK_SUCCESS) {
-		printf("Failed to create graphics pipeline. Error code: %d\n", result);
+		printf("Failed to create the overlay pipeline layout. Error code: %d\n", result);
 	} else {
-		printf("Graphics pipeline ready.\n");
+		VkGraphicsPipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_info.stageCount = 2;
+		pipeline_info.pStages = stages;
+		pipeline_info.pVertexInputState = &vertex_input_info;
+		pipeline_info.pInputAssemblyState = &assembly_info;
+		pipeline_info.pViewportState = &viewport_state;
+		pipeline_info.pRasterizationState = &rasterizer;
+		pipeline_info.pMultisampleState = &multisampling;
+		pipeline_info.pDepthStencilState = renderer->mesh_enabled ? &depth_stencil : NULL;
+		pipeline_info.pColorBlendState = &color_blending;
+		pipeline_info.pDynamicState = &dynamic_state;
+		pipeline_info.layout = renderer->overlay_layout;
+		pipeline_info.renderPass = renderer->render_pass;
+		pipeline_info.subpass = 0;
+		pipeline_info.basePipelineIndex = -1;
+		result = vkCreateGraphicsPipelines(renderer->logical_device, renderer->pipeline_cache, 1, &pipeline_info, NULL,
+			&renderer->overlay_pipeline);
+		if (result != VK_SUCCESS) {
+			printf("Failed to create the overlay pipeline. Error code: %d\n", result);
+			renderer->overlay_pipeline = VK_NULL_HANDLE;
+		}
 	}
-	vkDestroyShaderModule(renderer->logical_device, vert_shader_module, NULL);
-	vkDestroyShaderModule(renderer->logical_device, frag_shader_module, NULL);
+	vkDestroyShaderModule(renderer->logical_device, vertex_shader, NULL);
+	vkDestroyShaderModule(renderer->logical_device, fragment_shader, NULL);
+	return renderer->overlay_pipeline != VK_NULL_HANDLE;
+}
+
+struct PipelineBuild {
+	struct Renderer* renderer;
+	struct StartupTask* load_task;
+	struct PipelineSources* sources;
+	uint32_t shader_features;
+};
 
-	free(vshader_code);
-	free(fshader_code);
+void* compile_pipeline_task(void* arg) {
+	struct PipelineBuild* build = arg;
+	// depends on the loader task and on the render pass, which is created before this task starts
+	wait_task(build->load_task);
+	create_pipeline_cache(build->renderer, build->sources);
+	create_pipeline_layout(build->renderer);
+	if (create_shader_modules(build->renderer, build->sources)) {
+		select_pipeline(build->renderer, build->shader_features);
+	}
+	build->renderer->overlay_available = create_overlay_pipeline(build->renderer, build->sources);
+	return NULL;
 }
 
 struct OptionFamily {
@@ -424,7 +2096,7 @@ struct QueueFamily {
 };
 
 void create_image_views(struct Renderer* renderer) {
-	renderer->swap_chain_image_views = malloc(sizeof(VkImageView) * renderer->swap_chain_image_count);
+	renderer->swap_chain_image_views = heap_alloc(sizeof(VkImageView) * renderer->swap_chain_image_count);
 
 	for (uint32_t i = 0; i < renderer->swap_chain_image_count; i++) {
 		VkImageViewCreateInfo create_info = {};
@@ -492,6 +2164,8 @@ VkSurfaceFormatKHR choose_swapchain_surface_format(struct SwapChainDetails* deta
 }
 
 
+// The format and present mode arrays live in the startup arena. Callers rewind
+// the arena once they are done with the details.
 struct SwapChainDetails query_swapchain_details(struct Renderer* renderer) {
 	struct SwapChainDetails details = {};
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(renderer->physical_device, renderer->surface, &details.capabilities);
@@ -499,8 +2173,8 @@ struct SwapChainDetails query_swapchain_details(struct Renderer* renderer) {
 	uint32_t formats = 0;
 	vkGetPhysicalDeviceSurfaceFormatsKHR(renderer->physical_device, renderer->surface, &formats, NULL);
 	if (formats != 0) {
-		details.format_count = formats;
-		details.formats = malloc(sizeof(VkSurfaceFormatKHR) * formats);
+		details.formats = ARENA_ARRAY(&renderer->startup_arena, VkSurfaceFormatKHR, formats);
+		details.format_count = details.formats ? formats : 0;
 		vkGetPhysicalDeviceSurfaceFormatsKHR(renderer->physical_device, renderer->surface, &formats, details.formats);
 	}
 	
@@ -508,18 +2182,23 @@ struct SwapChainDetails query_swapchain_details(struct Renderer* renderer) {
 	vkGetPhysicalDeviceSurfacePresentModesKHR(renderer->physical_device, renderer->surface, &present_modes, NULL);
 
 	if (present_modes != 0) {
-		details.present_count = present_modes;
-		details.preset_modes = malloc(sizeof(VkPresentModeKHR) * present_modes);
+		details.preset_modes = ARENA_ARRAY(&renderer->startup_arena, VkPresentModeKHR, present_modes);
+		details.present_count = details.preset_modes ? present_modes : 0;
 		vkGetPhysicalDeviceSurfacePresentModesKHR(renderer->physical_device, renderer->surface, &present_modes, details.preset_modes);
 	}
 
 	return details;
 }
 struct QueueFamily find_queue_families(struct Renderer* renderer, VkPhysicalDevice device) {
-	struct QueueFamily family;
+	struct QueueFamily family = {};
 	uint32_t count = 0;
+	size_t mark = arena_mark(&renderer->startup_arena);
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &count, NULL);
-	VkQueueFamilyProperties family_properties[count];
+	VkQueueFamilyProperties* family_properties = ARENA_ARRAY(&renderer->startup_arena, VkQueueFamilyProperties, count);
+	if (!family_properties) {
+		arena_rewind(&renderer->startup_arena, mark);
+		return family;
+	}
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &count, family_properties);
 
 	for (uint32_t i = 0; i < count; i++) {
@@ -533,7 +2212,9 @@ struct QueueFamily find_queue_families(struct Renderer* renderer, VkPhysicalDevi
 			family.graphics = graphics_family;
 		}
 		VkBool32 present_support = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, renderer->surface, &present_support);
+		if (renderer->surface != VK_NULL_HANDLE) {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, renderer->surface, &present_support);
+		}
 		if (present_support) {
 			struct OptionFamily present_family = {
 				.value = i,
@@ -542,6 +2223,7 @@ struct QueueFamily find_queue_families(struct Renderer* renderer, VkPhysicalDevi
 			family.presentation = present_family;
 		} 
 	}
+	arena_rewind(&renderer->startup_arena, mark);
 	return family;
 }
 
@@ -560,10 +2242,89 @@ void create_command_pool(struct Renderer* renderer) {
 	}
 }
 
-void create_swap_chain(GLFWwindow* window, struct Renderer* renderer) {
+// One-shot work such as uploads goes through its own transient pool, which is
+// reset wholesale after every submission instead of freeing buffers one by one.
+void create_transient_command_pool(struct Renderer* renderer) {
+	struct QueueFamily family = find_queue_families(renderer, renderer->physical_device);
+	VkCommandPoolCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	info.queueFamilyIndex = family.graphics.value;
+
+	VkResult result = vkCreateCommandPool(renderer->logical_device, &info, NULL, &renderer->transient_command_pool);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create transient command pool. Error code: %d\n", result);
+	}
+
+	VkFenceCreateInfo fence_info = {};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	if (vkCreateFence(renderer->logical_device, &fence_info, NULL, &renderer->transient_fence) != VK_SUCCESS) {
+		printf("Failed to create transient fence.\n");
+	}
+}
+
+VkCommandBuffer begin_transient_commands(struct Renderer* renderer) {
+	VkCommandBufferAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandPool = renderer->transient_command_pool;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandBufferCount = 1;
+
+	VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+	VkResult result = vkAllocateCommandBuffers(renderer->logical_device, &alloc_info, &command_buffer);
+	if (result != VK_SUCCESS) {
+		printf("Failed to allocate transient command buffer. code: %d\n", result);
+		return VK_NULL_HANDLE;
+	}
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(command_buffer, &begin_info);
+	return command_buffer;
+}
+
+// Submits the commands and blocks until they are done. Meant for startup and
+// load time, never for the frame loop.
+void end_transient_commands(struct Renderer* renderer, VkCommandBuffer command_buffer) {
+	vkEndCommandBuffer(command_buffer);
+
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &command_buffer;
+
+	if (vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, renderer->transient_fence) != VK_SUCCESS) {
+		printf("Failed to submit transient work.\n");
+	} else {
+		vkWaitForFences(renderer->logical_device, 1, &renderer->transient_fence, VK_TRUE, UINT64_MAX);
+		vkResetFences(renderer->logical_device, 1, &renderer->transient_fence);
+	}
+	vkResetCommandPool(renderer->logical_device, renderer->transient_command_pool, 0);
+}
+
+// The surface format is picked ahead of the swapchain so the render pass and the
+// pipeline, which only depend on the format, can be built in parallel with it.
+void pick_surface_format(struct Renderer* renderer) {
+	if (renderer->headless) {
+		// same format a desktop surface usually gets, so golden images match both paths
+		renderer->swap_chain_image_format = VK_FORMAT_B8G8R8A8_SRGB;
+		renderer->swap_chain_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+		return;
+	}
+	size_t mark = arena_mark(&renderer->startup_arena);
 	struct SwapChainDetails details = query_swapchain_details(renderer);
 	VkSurfaceFormatKHR surface_format = choose_swapchain_surface_format(&details);
+	renderer->swap_chain_image_format = surface_format.format;
+	renderer->swap_chain_color_space = surface_format.colorSpace;
+	arena_rewind(&renderer->startup_arena, mark);
+}
+
+void create_swap_chain(GLFWwindow* window, struct Renderer* renderer) {
+	size_t mark = arena_mark(&renderer->startup_arena);
+	struct SwapChainDetails details = query_swapchain_details(renderer);
 	VkPresentModeKHR present_mode = choose_swapchain_present_mode(&details);
+	renderer->present_mode = present_mode;
 	VkExtent2D extent = choose_swap_extent(window, &details);
 	uint32_t image_count = details.capabilities.minImageCount + 1;
 
@@ -575,11 +2336,20 @@ void create_swap_chain(GLFWwindow* window, struct Renderer* renderer) {
 	create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	create_info.surface = renderer->surface;
 	create_info.minImageCount = image_count;
-	create_info.imageFormat = surface_format.format;
-	create_info.imageColorSpace = surface_format.colorSpace;
+	create_info.imageFormat = renderer->swap_chain_image_format;
+	create_info.imageColorSpace = renderer->swap_chain_color_space;
 	create_info.imageExtent = extent;
 	create_info.imageArrayLayers = 1;
 	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if (renderer->readback_enabled) {
+		if (details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+			create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		} else {
+			printf("Swapchain images cannot be copied from. Frame capture disabled.\n");
+			renderer->readback_enabled = false;
+			renderer->exporting = false;
+		}
+	}
 
 	struct QueueFamily family = find_queue_families(renderer, renderer->physical_device);
 	uint32_t queue_indices[2] = { family.graphics.value, family.presentation.value };
@@ -604,25 +2374,261 @@ void create_swap_chain(GLFWwindow* window, struct Renderer* renderer) {
 	}
 
 	vkGetSwapchainImagesKHR(renderer->logical_device, renderer->swap_chain, &image_count, NULL);
-	renderer->swap_chain_images = malloc(sizeof(VkImage) * image_count);
+	renderer->swap_chain_images = heap_alloc(sizeof(VkImage) * image_count);
 	vkGetSwapchainImagesKHR(renderer->logical_device, renderer->swap_chain, &image_count, renderer->swap_chain_images);
-	renderer->swap_chain_image_format = surface_format.format;
 	renderer->swap_chain_extent = extent; 
 	renderer->swap_chain_image_count = image_count;
 	printf("Swapchain created.\n");
 
-	free(details.formats);
-	free(details.preset_modes);
-	details.formats = NULL;
-	details.preset_modes = NULL;
+	arena_rewind(&renderer->startup_arena, mark);
+}
+
+// Headless stand-in for the swapchain: plain images the frames render into and
+// are read back from. They fill the same swap_chain_* fields so the rest of the
+// renderer does not care which one it draws to.
+void create_offscreen_targets(struct Renderer* renderer, uint32_t width, uint32_t height) {
+	renderer->swap_chain_extent.width = width;
+	renderer->swap_chain_extent.height = height;
+	renderer->swap_chain_image_count = OFFSCREEN_IMAGE_COUNT;
+	renderer->swap_chain_images = heap_alloc(sizeof(VkImage) * OFFSCREEN_IMAGE_COUNT);
+
+	for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; i++) {
+		VkImageCreateInfo image_info = {};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = renderer->swap_chain_image_format;
+		image_info.extent.width = width;
+		image_info.extent.height = height;
+		image_info.extent.depth = 1;
+		image_info.mipLevels = 1;
+		image_info.arrayLayers = 1;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VkResult result = vkCreateImage(renderer->logical_device, &image_info, NULL, &renderer->swap_chain_images[i]);
+		if (result != VK_SUCCESS) {
+			printf("Failed to create offscreen image. Error code: %d\n", result);
+			continue;
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(renderer->logical_device, renderer->swap_chain_images[i], &requirements);
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex =
+			find_memory_type(renderer, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		result = allocate_memory(renderer, &alloc_info, &renderer->offscreen_memory[i]);
+		if (result != VK_SUCCESS) {
+			printf("Failed to allocate offscreen image memory. Error code: %d\n", result);
+			continue;
+		}
+		vkBindImageMemory(renderer->logical_device, renderer->swap_chain_images[i], renderer->offscreen_memory[i], 0);
+	}
+	printf("Offscreen targets created: %d x %ux%u.\n", OFFSCREEN_IMAGE_COUNT, width, height);
+}
+
+// Every implementation supports D16_UNORM and one of the others as a depth attachment.
+VkFormat pick_depth_format(struct Renderer* renderer) {
+	VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32};
+	for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(renderer->physical_device, candidates[i], &properties);
+		if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+			return candidates[i];
+		}
+	}
+	return VK_FORMAT_D16_UNORM;
+}
+
+// An image only the render pass touches, sized to the swapchain. Transient
+// attachments go to lazily allocated memory where the device has it, so a
+// tiler can keep them in tile memory and never back them at all.
+bool create_attachment_image(struct Renderer* renderer, const char* name, VkFormat format, VkSampleCountFlagBits samples,
+	VkImageUsageFlags usage, VkImageAspectFlags aspect, VkImage* image, VkDeviceMemory* memory, VkImageView* view) {
+	VkImageCreateInfo image_info = {};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = format;
+	image_info.extent.width = renderer->swap_chain_extent.width;
+	image_info.extent.height = renderer->swap_chain_extent.height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = samples;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = usage;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkResult result = vkCreateImage(renderer->logical_device, &image_info, NULL, image);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create %s image. Error code: %d\n", name, result);
+		return false;
+	}
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(renderer->logical_device, *image, &requirements);
+	uint32_t memory_type = UINT32_MAX;
+	if (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) {
+		memory_type = find_memory_type(renderer, requirements.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+	}
+	if (memory_type == UINT32_MAX) {
+		memory_type = find_memory_type(renderer, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = requirements.size;
+	alloc_info.memoryTypeIndex = memory_type;
+	result = allocate_memory(renderer, &alloc_info, memory);
+	if (result != VK_SUCCESS) {
+		printf("Failed to allocate %s image memory. Error code: %d\n", name, result);
+		return false;
+	}
+	vkBindImageMemory(renderer->logical_device, *image, *memory, 0);
+
+	VkImageViewCreateInfo view_info = {};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = *image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = format;
+	view_info.subresourceRange.aspectMask = aspect;
+	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.layerCount = 1;
+	result = vkCreateImageView(renderer->logical_device, &view_info, NULL, view);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create %s image view. Error code: %d\n", name, result);
+		return false;
+	}
+	return true;
+}
+
+void create_depth_buffer(struct Renderer* renderer) {
+	create_attachment_image(renderer, "depth", renderer->depth_format, renderer->samples,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT,
+		&renderer->depth_image, &renderer->depth_memory, &renderer->depth_view);
+}
+
+// Only the resolved swapchain image outlives the render pass, the samples are discarded.
+void create_multisample_target(struct Renderer* renderer) {
+	create_attachment_image(renderer, "multisampled colour", renderer->swap_chain_image_format, renderer->samples,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+		&renderer->color_image, &renderer->color_memory, &renderer->color_view);
+}
+
+// Highest sample count up to requested that the colour attachment, and the
+// depth attachment when there is one, support.
+VkSampleCountFlagBits pick_sample_count(struct Renderer* renderer, uint32_t requested) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+	VkSampleCountFlags supported = properties.limits.framebufferColorSampleCounts;
+	if (renderer->mesh_enabled) {
+		supported &= properties.limits.framebufferDepthSampleCounts;
+	}
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_64_BIT;
+	while (samples > VK_SAMPLE_COUNT_1_BIT && (samples > requested || !(supported & samples))) {
+		samples >>= 1;
+	}
+	if (samples < requested) {
+		printf("%ux MSAA not supported, using %ux.\n", requested, (uint32_t) samples);
+	}
+	return samples;
+}
+
+// Maps the unorm positions into the unit sphere around the mesh. Folding the
+// dequantization into this matrix costs the vertex shader nothing; scenes
+// place and view the unit sphere.
+void compute_mesh_constants(struct Renderer* renderer, const struct MeshFileHeader* header) {
+	const float* min = header->bounds_min;
+	const float* extent = header->bounds_extent;
+	float radius = 0.5f * sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+	float scale = radius > 0.0f ? 1.0f / radius : 1.0f;
+	float dequantize[16] = {
+		extent[0], 0.0f, 0.0f, 0.0f,
+		0.0f, extent[1], 0.0f, 0.0f,
+		0.0f, 0.0f, extent[2], 0.0f,
+		min[0], min[1], min[2], 1.0f,
+	};
+	float normalize[16] = {
+		scale, 0.0f, 0.0f, 0.0f,
+		0.0f, scale, 0.0f, 0.0f,
+		0.0f, 0.0f, scale, 0.0f,
+		-(min[0] + 0.5f * extent[0]) * scale, -(min[1] + 0.5f * extent[1]) * scale, -(min[2] + 0.5f * extent[2]) * scale, 1.0f,
+	};
+	mat4_multiply(renderer->mesh_constants.model, normalize, dequantize);
+	renderer->mesh_radius = radius > 0.0f ? radius : 1.0f;
+}
+
+// Copies the mapped mesh file into device local buffers through one staging
+// buffer. The file layout is the buffer layout, so nothing is converted.
+bool upload_mesh(struct Renderer* renderer, struct MappedMesh* mesh) {
+	const struct MeshFileHeader* header = mesh->header;
+	if (!header || header->vertex_count == 0 || header->index_count == 0) {
+		printf("No mesh to upload.\n");
+		return false;
+	}
+	VkDeviceSize vertex_size = (VkDeviceSize) header->vertex_count * sizeof(struct PackedVertex);
+	VkDeviceSize index_size = (VkDeviceSize) header->index_count * header->index_size;
+
+	VkBuffer staging = VK_NULL_HANDLE;
+	VkDeviceMemory staging_memory = VK_NULL_HANDLE;
+	VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	if (!create_buffer(renderer, vertex_size + index_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, host, host,
+		&staging, &staging_memory, NULL)) {
+		return false;
+	}
+	// device local is preferred, any memory the buffer can live in will do on integrated GPUs
+	if (!create_buffer(renderer, vertex_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &renderer->mesh_vertex_buffer, &renderer->mesh_vertex_memory, NULL) ||
+		!create_buffer(renderer, index_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &renderer->mesh_index_buffer, &renderer->mesh_index_memory, NULL)) {
+		destroy_buffer(renderer, staging, staging_memory);
+		return false;
+	}
+
+	uint8_t* mapped = NULL;
+	vkMapMemory(renderer->logical_device, staging_memory, 0, VK_WHOLE_SIZE, 0, (void**) &mapped);
+	memcpy(mapped, mesh->vertices, vertex_size);
+	memcpy(mapped + vertex_size, mesh->indices, index_size);
+	vkUnmapMemory(renderer->logical_device, staging_memory);
+
+	VkCommandBuffer command_buffer = begin_transient_commands(renderer);
+	VkBufferCopy vertex_copy = {.srcOffset = 0, .dstOffset = 0, .size = vertex_size};
+	VkBufferCopy index_copy = {.srcOffset = vertex_size, .dstOffset = 0, .size = index_size};
+	vkCmdCopyBuffer(command_buffer, staging, renderer->mesh_vertex_buffer, 1, &vertex_copy);
+	vkCmdCopyBuffer(command_buffer, staging, renderer->mesh_index_buffer, 1, &index_copy);
+	end_transient_commands(renderer, command_buffer);
+	destroy_buffer(renderer, staging, staging_memory);
+
+	renderer->mesh_index_type = header->index_size == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	memcpy(renderer->mesh_lods, header->lods, sizeof(renderer->mesh_lods));
+	renderer->mesh_lod_count = header->lod_count;
+	compute_mesh_constants(renderer, header);
+	// sized for the largest scene up front, the frame loop never allocates
+	renderer->mesh_instances = heap_alloc(sizeof(struct MeshInstance) * FIELD_SIZE * FIELD_SIZE);
+	if (!renderer->mesh_instances) {
+		printf("Failed to allocate mesh instances.\n");
+		return false;
+	}
+	memset(renderer->mesh_instances, 0, sizeof(struct MeshInstance) * FIELD_SIZE * FIELD_SIZE);
+	printf("Mesh uploaded: %u vertices, %u triangles in %u detail levels, %lu bytes.\n", header->vertex_count,
+		header->lods[0].index_count / 3, header->lod_count, (unsigned long) (vertex_size + index_size));
+	return true;
 }
 
-int check_validation_layers_support() {
+int check_validation_layers_support(struct Arena* scratch) {
 	uint32_t available_layers_size;
 	vkEnumerateInstanceLayerProperties(&available_layers_size, NULL);
 	
 	printf("Available layers count: %d\n", available_layers_size);
-	VkLayerProperties layers[available_layers_size];
+	size_t mark = arena_mark(scratch);
+	VkLayerProperties* layers = ARENA_ARRAY(scratch, VkLayerProperties, available_layers_size);
+	if (!layers) {
+		return false;
+	}
 	vkEnumerateInstanceLayerProperties(&available_layers_size, layers);
 	
 	bool found = false;
@@ -638,66 +2644,83 @@ int check_validation_layers_support() {
 			}
 		}
 		if (!found) {
+			arena_rewind(scratch, mark);
 			return false;
 		} 
 	}
+	arena_rewind(scratch, mark);
 	return true;
 }
 
 
 
-bool check_device_extension_support(VkPhysicalDevice device) {
+bool check_device_extension_support(struct Arena* scratch, VkPhysicalDevice device) {
 	uint32_t count;
 	vkEnumerateDeviceExtensionProperties(device, NULL, &count, NULL);
-	VkExtensionProperties available_extensions[count];
+	size_t mark = arena_mark(scratch);
+	VkExtensionProperties* available_extensions = ARENA_ARRAY(scratch, VkExtensionProperties, count);
+	if (!available_extensions) {
+		return false;
+	}
 	vkEnumerateDeviceExtensionProperties(device, NULL, &count, available_extensions);
 	const uint32_t DEVICE_EXT_COUNT = 1;
-	bool found = false;
 	for (uint32_t i = 0; i < DEVICE_EXT_COUNT; i++) {
 		const char* ext_name = DEVICE_EXTENSIONS[i];
+		bool found = false;
 		for (uint32_t j = 0; j < count; j++) {
-			VkExtensionProperties ext = available_extensions[i];
+			VkExtensionProperties ext = available_extensions[j];
 			if (strcmp(ext_name, ext.extensionName) == 0) {
 				found = true;
 				break;
 			}
 		}
 		if (!found) {
+			arena_rewind(scratch, mark);
 			return false;
 		}
 		
 	}
+	arena_rewind(scratch, mark);
 	return true;
 }
 
-bool is_queue_family_ready(struct QueueFamily family) {
-	return family.graphics.is_present && family.presentation.is_present;
+bool is_queue_family_ready(struct Renderer* renderer, struct QueueFamily family) {
+	return family.graphics.is_present && (renderer->headless || family.presentation.is_present);
 }
 
 void create_logical_device(struct Renderer* renderer) {
 	struct QueueFamily family = find_queue_families(renderer, renderer->physical_device);
 		
-	const uint32_t QUEUE_COUNT = 2; // 0. graphics. 1. presentation
-	VkDeviceQueueCreateInfo queue_infos[QUEUE_COUNT];
+	if (renderer->headless) {
+		family.presentation = family.graphics;
+	}
+	// 0. graphics. 1. presentation, when it is a different family
+	uint32_t families[2] = { family.graphics.value, family.presentation.value };
+	uint32_t queue_count = families[0] == families[1] ? 1 : 2;
+	VkDeviceQueueCreateInfo queue_infos[2];
 
 	float priority = 1.0f;
-	for (uint32_t i = 0; i < QUEUE_COUNT; i++) {
+	for (uint32_t i = 0; i < queue_count; i++) {
 		VkDeviceQueueCreateInfo create_info = {};
 		create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		create_info.queueFamilyIndex = i;
+		create_info.queueFamilyIndex = families[i];
 		create_info.queueCount = 1;
 		create_info.pQueuePriorities = &priority;
 		queue_infos[i] = create_info;
 	}
 
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(renderer->physical_device, &supported_features);
 	VkPhysicalDeviceFeatures device_features = {};
+	// optional, only the stats report needs it
+	device_features.pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery;
 
 	VkDeviceCreateInfo logical_create_info = {};
 	logical_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	logical_create_info.pQueueCreateInfos = queue_infos;
-	logical_create_info.queueCreateInfoCount = QUEUE_COUNT;
+	logical_create_info.queueCreateInfoCount = queue_count;
 	logical_create_info.pEnabledFeatures = &device_features;
-	logical_create_info.enabledExtensionCount = 1;
+	logical_create_info.enabledExtensionCount = renderer->headless ? 0 : 1;
 	logical_create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS;
 	
 
@@ -771,12 +2794,12 @@ void create_surface(GLFWwindow* window, struct Renderer* renderer) {
 }
 
 void create_vk_instance(struct Renderer* renderer) {
-	
-	if (!check_validation_layers_support()) {
-		printf("Missing validation layers.\n");
-		return;
-	}
-	printf("Validation layers are present.\n");
+	struct Arena* scratch = &renderer->startup_arena;
+	size_t mark = arena_mark(scratch);
+
+	// software drivers on CI machines often ship without the layers, so they are optional
+	bool validation = check_validation_layers_support(scratch);
+	printf(validation ? "Validation layers are present.\n" : "Missing validation layers, continuing without them.\n");
 
 	VkApplicationInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -790,33 +2813,39 @@ void create_vk_instance(struct Renderer* renderer) {
 	create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	create_info.pApplicationInfo = &info;
 
-	uint32_t glfw_ext_count;
-	const char** glfw_ext_names = glfw_ext_names = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
-	const char* required_exts[glfw_ext_count + 1];
-	for (uint32_t i = 0; i < glfw_ext_count; i++) {
-		required_exts[i] = glfw_ext_names[i];
+	uint32_t glfw_ext_count = 0;
+	const char** glfw_ext_names = NULL;
+	if (!renderer->headless) {
+		glfw_ext_names = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
 	}
-	required_exts[glfw_ext_count] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
-	
-	for (uint32_t i = 0; i < glfw_ext_count + 1; i++) {
-		printf(" * Required extension: [%s]\n", required_exts[i]);
+	const char** required_exts = ARENA_ARRAY(scratch, const char*, glfw_ext_count + 1);
+	if (required_exts) {
+		for (uint32_t i = 0; i < glfw_ext_count; i++) {
+			required_exts[i] = glfw_ext_names[i];
+		}
+		required_exts[glfw_ext_count] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+
+		for (uint32_t i = 0; i < glfw_ext_count + 1; i++) {
+			printf(" * Required extension: [%s]\n", required_exts[i]);
+		}
 	}
 
 	create_info.enabledExtensionCount = glfw_ext_count;
 	create_info.ppEnabledExtensionNames = glfw_ext_names;
-	create_info.enabledLayerCount = 1;
+	create_info.enabledLayerCount = validation ? 1 : 0;
 	create_info.ppEnabledLayerNames = VALIDATION_LAYERS;
 
 	printf("Available Vulkan extensions:\n");
 	
 	uint32_t available_ext_count = 0;
 	vkEnumerateInstanceExtensionProperties(NULL, &available_ext_count, NULL);
-	VkExtensionProperties properties[available_ext_count];
-	
-	vkEnumerateInstanceExtensionProperties(NULL, &available_ext_count, properties);
+	VkExtensionProperties* properties = ARENA_ARRAY(scratch, VkExtensionProperties, available_ext_count);
+	if (properties) {
+		vkEnumerateInstanceExtensionProperties(NULL, &available_ext_count, properties);
 
-	for (uint32_t i = 0; i < available_ext_count; i++) {
-		printf(" * %s\n", properties[i].extensionName);
+		for (uint32_t i = 0; i < available_ext_count; i++) {
+			printf(" * %s\n", properties[i].extensionName);
+		}
 	}
 	VkResult result = vkCreateInstance(&create_info, NULL, &renderer->instance); 
 	if (result != VK_SUCCESS) {
@@ -824,6 +2853,7 @@ void create_vk_instance(struct Renderer* renderer) {
 	} else {
 		printf("Vulkan initialized successfully.\n");
 	}
+	arena_rewind(scratch, mark);
 }
 
 void pick_physical_device(struct Renderer* renderer){
@@ -834,90 +2864,534 @@ void pick_physical_device(struct Renderer* renderer){
 		printf("Failed to find GPUs with VULKAN support");
 	}
 
-	VkPhysicalDevice devices[device_count];
+	size_t mark = arena_mark(&renderer->startup_arena);
+	VkPhysicalDevice* devices = ARENA_ARRAY(&renderer->startup_arena, VkPhysicalDevice, device_count);
+	if (!devices) {
+		return;
+	}
 	vkEnumeratePhysicalDevices(renderer->instance, &device_count, devices);
 	
-	// check if device is suitable
+	// check if device is suitable. A discrete GPU wins, otherwise the first device
+	// that can render is used, which lets software drivers like lavapipe run the app.
+	VkPhysicalDeviceProperties picked_properties = {};
 	for (uint32_t i = 0; i< device_count; i++) {
 		VkPhysicalDevice device = devices[i];
 		VkPhysicalDeviceProperties properties;
-		VkPhysicalDeviceFeatures features;
 		vkGetPhysicalDeviceProperties(device, &properties);
-		vkGetPhysicalDeviceFeatures(device, &features);
-		if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && features.geometryShader) {
-			struct QueueFamily family = find_queue_families(renderer, device);
-	 		if (is_queue_family_ready(family)) {
-				renderer->physical_device = device;
-				struct SwapChainDetails details = query_swapchain_details(renderer);
-				if (!details.preset_modes) {
-					printf("Failed to collect presentation modes. should abort.\n");
-				}
-				create_logical_device(renderer);
-				printf("GPU: %s has been picked.\n", properties.deviceName);
+		struct QueueFamily family = find_queue_families(renderer, device);
+		if (!is_queue_family_ready(renderer, family)) {
+			continue;
+		}
+		bool discrete = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+		if (renderer->physical_device == NULL || discrete) {
+			renderer->physical_device = device;
+			picked_properties = properties;
+			if (discrete) {
 				break;
-			} 
-		} 
+			}
+		}
 	}
+	arena_rewind(&renderer->startup_arena, mark);
 	if (renderer->physical_device == NULL) {
 		printf("Failed to find a suitable GPU.\n");
+		return;
+	}
+
+	if (!renderer->headless) {
+		size_t details_mark = arena_mark(&renderer->startup_arena);
+		struct SwapChainDetails details = query_swapchain_details(renderer);
+		if (!details.preset_modes) {
+			printf("Failed to collect presentation modes. should abort.\n");
+		}
+		arena_rewind(&renderer->startup_arena, details_mark);
+	}
+	create_logical_device(renderer);
+	printf("GPU: %s has been picked.\n", picked_properties.deviceName);
+}
+
+// Compares the frame captured by the last draw_frame() with the reference image,
+// or replaces the reference with it.
+bool check_golden(struct Renderer* renderer, struct Options* options) {
+	struct ReadbackSlot* slot = renderer->last_readback;
+	if (!slot) {
+		printf("No frame was captured for the golden comparison.\n");
+		return false;
+	}
+	const uint8_t* pixels = map_readback(renderer, slot);
+	uint32_t width = renderer->swap_chain_extent.width;
+	uint32_t height = renderer->swap_chain_extent.height;
+	bool bgra = is_bgra_format(renderer->swap_chain_image_format);
+	if (options->update_golden) {
+		return update_golden(options->golden_path, pixels, width, height, width * 4, bgra);
 	}
+	struct GoldenResult result;
+	return compare_with_golden(options->golden_path, pixels, width, height, width * 4, bgra,
+		options->tolerance, GOLDEN_MAX_MISMATCH, &result);
 }
 
 void freeMemory(GLFWwindow* window, struct Renderer* renderer) {
-	vkDestroySemaphore(renderer->logical_device, renderer->image_available_semaphore, NULL);
-	vkDestroySemaphore(renderer->logical_device, renderer->render_finished_semaphore, NULL);
-	vkDestroyFence(renderer->logical_device, renderer->in_flight_fence, NULL);
+	if (renderer->exporting) {
+		// oldest first, the device is idle so every slot's frame is complete
+		for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+			struct FrameSlot* frame = &renderer->frames[(renderer->frame_index + i) % FRAMES_IN_FLIGHT];
+			if (frame->readback) {
+				hand_off_readback(renderer, frame->readback);
+				frame->readback = NULL;
+			}
+		}
+		image_writer_stop(&renderer->image_writer);
+		printf("Frames not exported because the writer fell behind: %lu\n", (unsigned long) renderer->readback_dropped);
+	}
+	if (renderer->metrics_enabled) {
+		metrics_server_stop(&renderer->metrics);
+	}
+	destroy_readback_ring(renderer);
+	vkDestroyBuffer(renderer->logical_device, renderer->mesh_vertex_buffer, NULL);
+	free_memory(renderer, renderer->mesh_vertex_memory);
+	vkDestroyBuffer(renderer->logical_device, renderer->mesh_index_buffer, NULL);
+	free_memory(renderer, renderer->mesh_index_memory);
+	heap_free(renderer->mesh_instances);
+	destroy_uniform_ring(renderer);
+	destroy_overlay(renderer);
+	vkDestroyQueryPool(renderer->logical_device, renderer->statistics_pool, NULL);
+	vkDestroyImageView(renderer->logical_device, renderer->depth_view, NULL);
+	vkDestroyImage(renderer->logical_device, renderer->depth_image, NULL);
+	free_memory(renderer, renderer->depth_memory);
+	vkDestroyImageView(renderer->logical_device, renderer->color_view, NULL);
+	vkDestroyImage(renderer->logical_device, renderer->color_image, NULL);
+	free_memory(renderer, renderer->color_memory);
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		vkDestroySemaphore(renderer->logical_device, renderer->frames[i].image_available_semaphore, NULL);
+		vkDestroySemaphore(renderer->logical_device, renderer->frames[i].render_finished_semaphore, NULL);
+		vkDestroyFence(renderer->logical_device, renderer->frames[i].in_flight_fence, NULL);
+		heap_free(renderer->frames[i].image_command_buffers);
+	}
+	vkDestroyFence(renderer->logical_device, renderer->transient_fence, NULL);
+	vkDestroyCommandPool(renderer->logical_device, renderer->transient_command_pool, NULL);
 	vkDestroyCommandPool(renderer->logical_device, renderer->command_pool, NULL);
 	for (uint32_t i = 0; i < renderer->swap_chain_image_count; i++) {
 		vkDestroyFramebuffer(renderer->logical_device, renderer->swapchain_frame_buffers[i], NULL);
 	}
-	vkDestroyPipeline(renderer->logical_device, renderer->graphics_pipeline, NULL);
+	save_pipeline_cache(renderer);
+	vkDestroyPipelineCache(renderer->logical_device, renderer->pipeline_cache, NULL);
+	pipeline_variants_destroy(&renderer->pipelines, renderer->logical_device);
+	vkDestroyShaderModule(renderer->logical_device, renderer->vertex_shader, NULL);
+	vkDestroyShaderModule(renderer->logical_device, renderer->fragment_shader, NULL);
 	vkDestroyPipelineLayout(renderer->logical_device, renderer->pipeline_layout, NULL);
 	vkDestroyRenderPass(renderer->logical_device, renderer->render_pass, NULL);
 	for (uint32_t i = 0; i < renderer->swap_chain_image_count; i++) {
 		vkDestroyImageView(renderer->logical_device, renderer->swap_chain_image_views[i], NULL);
 	}
-	vkDestroySwapchainKHR(renderer->logical_device, renderer->swap_chain, NULL);
+	if (renderer->headless) {
+		for (uint32_t i = 0; i < renderer->swap_chain_image_count; i++) {
+			vkDestroyImage(renderer->logical_device, renderer->swap_chain_images[i], NULL);
+			free_memory(renderer, renderer->offscreen_memory[i]);
+		}
+	} else {
+		vkDestroySwapchainKHR(renderer->logical_device, renderer->swap_chain, NULL);
+	}
 	vkDestroyDevice(renderer->logical_device, NULL);
-	vkDestroySurfaceKHR(renderer->instance, renderer->surface, NULL);
+	if (!renderer->headless) {
+		vkDestroySurfaceKHR(renderer->instance, renderer->surface, NULL);
+	}
 	vkDestroyInstance(renderer->instance, NULL);
-	free(renderer->swap_chain_image_views);
+	heap_free(renderer->swapchain_frame_buffers);
+	heap_free(renderer->swap_chain_image_views);
+	heap_free(renderer->swap_chain_images);
+	arena_destroy(&renderer->frame_arena);
+	arena_destroy(&renderer->startup_arena);
+
+	if (window) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+}
 
-	glfwDestroyWindow(window);
-	glfwTerminate();
+void print_usage(const char* program) {
+	printf("Usage: %s [options]\n", program);
+	printf("  --static              pre-record one command buffer per swapchain image and re-submit it\n");
+	printf("  --export <dir>        write every rendered frame to <dir>\n");
+	printf("  --export-format <f>   png (default), ppm or raw\n");
+	printf("  --headless            render offscreen without a window or surface\n");
+	printf("  --size <w>x<h>        offscreen image size (default 800x600)\n");
+	printf("  --frames <n>          quit after n frames (default %lu when headless)\n", (unsigned long) HEADLESS_DEFAULT_FRAMES);
+	printf("  --scene <s>           triangle (default), grid, or field with --mesh\n");
+	printf("  --golden <file.ppm>   compare the last frame with a reference image, exit 1 on mismatch\n");
+	printf("  --update-golden       write the last frame to the --golden file instead of comparing\n");
+	printf("  --tolerance <n>       per channel difference allowed by --golden (default 2)\n");
+	printf("  --max-frame-ms <ms>   exit 1 when the average frame time exceeds this budget\n");
+	printf("  --mesh <file.mesh>    draw a mesh converted by mesh_tool instead of the triangle\n");
+	printf("  --features <list>     mesh shader features: lighting (default), lod-tint, normal-color, or none\n");
+	printf("  --msaa <n>            samples per pixel, rounded down to what the device supports (default 1)\n");
+	printf("  --overlay             show frame, GPU and memory statistics on screen (toggle with O)\n");
+	printf("  --metrics-socket <p>  serve the statistics as text to each connection on Unix socket <p>\n");
+	printf("  --metrics-file <p>    keep the statistics as text in file <p>, rewritten twice a second\n");
 }
 
-int main(void) {
-    if (!glfwInit()) {
-		printf("Failed to initialize GLFW.");
-		return -1;
+bool parse_options(int argc, char** argv, struct Options* options) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--static") == 0) {
+			options->static_commands = true;
+		} else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+			options->export_directory = argv[++i];
+		} else if (strcmp(argv[i], "--export-format") == 0 && i + 1 < argc) {
+			if (!parse_image_file_format(argv[++i], &options->export_format)) {
+				printf("Unknown export format: %s\n", argv[i]);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			options->headless = true;
+		} else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%ux%u", &options->width, &options->height) != 2 ||
+				options->width == 0 || options->height == 0) {
+				printf("Invalid size: %s\n", argv[i]);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			options->frames = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "triangle") == 0) {
+				options->scene = SCENE_TRIANGLE;
+			} else if (strcmp(argv[i], "grid") == 0) {
+				options->scene = SCENE_GRID;
+			} else if (strcmp(argv[i], "field") == 0) {
+				options->scene = SCENE_FIELD;
+			} else {
+				printf("Unknown scene: %s\n", argv[i]);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+			options->golden_path = argv[++i];
+		} else if (strcmp(argv[i], "--update-golden") == 0) {
+			options->update_golden = true;
+		} else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+			options->tolerance = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--max-frame-ms") == 0 && i + 1 < argc) {
+			options->max_frame_ms = strtod(argv[++i], NULL);
+		} else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+			options->mesh_path = argv[++i];
+		} else if (strcmp(argv[i], "--features") == 0 && i + 1 < argc) {
+			if (!parse_shader_features(argv[++i], &options->shader_features)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--msaa") == 0 && i + 1 < argc) {
+			options->msaa_samples = strtoul(argv[++i], NULL, 10);
+			if (options->msaa_samples == 0) {
+				printf("Invalid sample count: %s\n", argv[i]);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--overlay") == 0) {
+			options->overlay = true;
+		} else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc) {
+			options->metrics_socket = argv[++i];
+		} else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+			options->metrics_file = argv[++i];
+		} else {
+			print_usage(argv[0]);
+			return false;
+		}
+	}
+	if (options->scene == SCENE_FIELD && !options->mesh_path) {
+		printf("--scene field needs a --mesh to draw.\n");
+		return false;
+	}
+	return true;
+}
+
+// Render thread: acquire, record, submit and present, blocking on the GPU and
+// the display as needed without holding up input handling.
+void* render_thread(void* arg) {
+	struct RenderLoop* loop = arg;
+	struct Renderer* renderer = loop->renderer;
+	struct Options* options = loop->options;
+
+	// once the first frames have warmed up, the frame loop must not touch the heap;
+	// malloc calls of every thread and library are counted, heap_alloc() only the renderer's own
+	uint64_t steady_state_mallocs = 0;
+	uint64_t steady_state_allocations = 0;
+	double steady_state_start = now_seconds();
+	while (atomic_load(&loop->running) && (options->frames == 0 || loop->frame_count < options->frames)) {
+		if (triple_buffer_acquire(&loop->packets)) {
+			apply_frame_packet(renderer, &loop->packet_slots[triple_buffer_read_index(&loop->packets)]);
+		}
+		if (options->golden_path && loop->frame_count + 1 == options->frames) {
+			renderer->capture_next_frame = true;
+		}
+		draw_frame(renderer);
+		if (++loop->frame_count == WARMUP_FRAMES) {
+			steady_state_mallocs = malloc_call_count();
+			steady_state_allocations = heap_alloc_count();
+			steady_state_start = now_seconds();
+		}
+	}
+	if (loop->frame_count > WARMUP_FRAMES) {
+		loop->frame_ms = (now_seconds() - steady_state_start) * 1000.0 / (loop->frame_count - WARMUP_FRAMES);
+		uint64_t mallocs = malloc_call_count() - steady_state_mallocs;
+		uint64_t allocations = heap_alloc_count() - steady_state_allocations;
+		if (malloc_counting()) {
+			printf("Heap allocations over %lu steady-state frames: %lu, %lu of them by the renderer.\n",
+				(unsigned long) (loop->frame_count - WARMUP_FRAMES), (unsigned long) mallocs,
+				(unsigned long) allocations);
+		} else {
+			printf("Renderer heap allocations over %lu steady-state frames: %lu, other callers not counted.\n",
+				(unsigned long) (loop->frame_count - WARMUP_FRAMES), (unsigned long) allocations);
+		}
+		printf("Frame arena peak: %zu bytes.\n", renderer->frame_arena.high_water);
+		printf("Average frame time: %.3f ms\n", loop->frame_ms);
 	}
+	atomic_store(&loop->running, false);
+	if (!renderer->headless) {
+		// the input thread may be asleep in glfwWaitEventsTimeout()
+		glfwPostEmptyEvent();
+	}
+	return NULL;
+}
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-	GLFWwindow* window = glfwCreateWindow(800, 600, "Hello Vulkan", NULL, NULL);
-	
-	if (!window) {
-		glfwTerminate();
+void publish_frame_packet(struct RenderLoop* loop, struct InputState* input) {
+	struct FramePacket* packet = &loop->packet_slots[triple_buffer_write_index(&loop->packets)];
+	packet->scene = input->scene;
+	packet->shader_features = input->shader_features;
+	packet->overlay = input->overlay;
+	packet->input_time = input->input_time;
+	triple_buffer_publish(&loop->packets);
+}
+
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	(void) scancode;
+	(void) mods;
+	struct InputState* input = glfwGetWindowUserPointer(window);
+	if (action != GLFW_PRESS) {
+		return;
+	}
+	input->input_time = now_seconds();
+	if (key == GLFW_KEY_T) {
+		input->scene = SCENE_TRIANGLE;
+	} else if (key == GLFW_KEY_G) {
+		input->scene = SCENE_GRID;
+	} else if (key == GLFW_KEY_F && input->mesh_enabled) {
+		input->scene = SCENE_FIELD;
+	} else if (key == GLFW_KEY_L && input->mesh_enabled) {
+		input->shader_features ^= SHADER_FEATURE_LIGHTING;
+	} else if (key == GLFW_KEY_V && input->mesh_enabled) {
+		input->shader_features ^= SHADER_FEATURE_LOD_TINT;
+	} else if (key == GLFW_KEY_C && input->mesh_enabled) {
+		input->shader_features ^= SHADER_FEATURE_NORMAL_COLOR;
+	} else if (key == GLFW_KEY_O) {
+		input->overlay = !input->overlay;
+	} else if (key == GLFW_KEY_ESCAPE) {
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	}
+}
+
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+	(void) button;
+	(void) mods;
+	struct InputState* input = glfwGetWindowUserPointer(window);
+	if (action == GLFW_PRESS) {
+		input->input_time = now_seconds();
+	}
+}
+
+int main(int argc, char** argv) {
+	double launch_time = now_seconds();
+	struct Options options = {
+		.export_format = IMAGE_FILE_PNG,
+		.width = 800,
+		.height = 600,
+		.tolerance = 2,
+		.shader_features = SHADER_FEATURE_DEFAULTS,
+		.msaa_samples = 1,
+	};
+	if (!parse_options(argc, argv, &options)) {
 		return -1;
 	}
+	if ((options.headless || options.golden_path) && options.frames == 0) {
+		options.frames = HEADLESS_DEFAULT_FRAMES;
+	}
+
+	// Startup task graph. Reading SPIR-V and the pipeline cache needs nothing, so it
+	// starts right away. Compiling the pipeline needs the device, the render pass and
+	// the loaded files, and runs while the swapchain and its dependents are created:
+	//
+	//   load sources ----------------------------.
+	//   instance -> surface -> device -> format -> render pass -> compile pipeline --.
+	//                                              `-> swapchain -> views -> framebuffers -> ... -> first frame
+	struct PipelineSources sources = {
+		.mesh_path = options.mesh_path,
+	};
+	struct StartupTask load_task = {};
+	struct StartupTask compile_task = {};
+	start_task(&load_task, load_pipeline_sources_task, &sources);
+
+	GLFWwindow* window = NULL;
+	if (!options.headless) {
+		if (!glfwInit()) {
+			printf("Failed to initialize GLFW.");
+			wait_task(&load_task);
+			release_pipeline_sources(&sources);
+			return -1;
+		}
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+		window = glfwCreateWindow(options.width, options.height, "Hello Vulkan", NULL, NULL);
+
+		if (!window) {
+			glfwTerminate();
+			wait_task(&load_task);
+			release_pipeline_sources(&sources);
+			return -1;
+		}
+	}
 	struct Renderer renderer = {};
+	renderer.headless = options.headless;
+	renderer.scene = options.scene;
+	renderer.final_layout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	renderer.launch_time = launch_time;
+	renderer.cpu_report_time = launch_time;
+	renderer.static_commands = options.static_commands;
+	renderer.exporting = options.export_directory != NULL;
+	renderer.readback_enabled = renderer.exporting || options.golden_path != NULL;
+	renderer.mesh_enabled = options.mesh_path != NULL;
+	arena_init(&renderer.startup_arena, "startup", STARTUP_ARENA_SIZE);
+	arena_init(&renderer.frame_arena, "frame", FRAME_ARENA_SIZE);
 	create_vk_instance(&renderer);
-	create_surface(window, &renderer);
+	if (!renderer.headless) {
+		create_surface(window, &renderer);
+	}
 	pick_physical_device(&renderer);
-	create_swap_chain(window, &renderer);
-	create_image_views(&renderer);
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(renderer.physical_device, &memory_properties);
+	memory_tracker_init(&renderer.memory, &memory_properties);
+	pick_surface_format(&renderer);
+	renderer.samples = pick_sample_count(&renderer, options.msaa_samples);
+	if (renderer.mesh_enabled) {
+		renderer.depth_format = pick_depth_format(&renderer);
+	}
 	create_render_pass(&renderer);
-	create_graphics_pipeline(&renderer);
+
+	struct PipelineBuild build = {
+		.renderer = &renderer,
+		.load_task = &load_task,
+		.sources = &sources,
+		.shader_features = options.shader_features,
+	};
+	start_task(&compile_task, compile_pipeline_task, &build);
+
+	if (renderer.headless) {
+		create_offscreen_targets(&renderer, options.width, options.height);
+	} else {
+		create_swap_chain(window, &renderer);
+	}
+	if (renderer.readback_enabled && !create_readback_ring(&renderer)) {
+		renderer.readback_enabled = false;
+		renderer.exporting = false;
+	}
+	if (renderer.exporting && !image_writer_start(&renderer.image_writer, options.export_directory,
+		options.export_format, renderer.swap_chain_extent.width)) {
+		// frames would only be read back to be dropped; the ring stays for --golden
+		renderer.exporting = false;
+		renderer.readback_enabled = options.golden_path != NULL;
+	}
+	create_image_views(&renderer);
+	if (renderer.mesh_enabled) {
+		create_depth_buffer(&renderer);
+	}
+	if (renderer.samples != VK_SAMPLE_COUNT_1_BIT) {
+		create_multisample_target(&renderer);
+	}
 	create_frame_buffers(&renderer);
 	create_command_pool(&renderer);
+	create_transient_command_pool(&renderer);
 	create_command_buffer(&renderer);
 	create_sync_objects(&renderer);
-	while(!glfwWindowShouldClose(window)) {
-		glfwPollEvents();
-		draw_frame(&renderer);
+	create_statistics_queries(&renderer);
+	wait_task(&compile_task);
+	if (renderer.graphics_pipeline == VK_NULL_HANDLE) {
+		// nothing could be drawn, the compile task has printed why
+		printf("No graphics pipeline, exiting.\n");
+		release_pipeline_sources(&sources);
+		freeMemory(window, &renderer);
+		return -1;
+	}
+	if (renderer.mesh_enabled) {
+		// mapped by the loader task, which the compile task has joined
+		bool uploaded = upload_mesh(&renderer, &sources.mesh) && create_uniform_ring(&renderer);
+		mesh_unmap(&sources.mesh);
+		if (!uploaded) {
+			release_pipeline_sources(&sources);
+			freeMemory(window, &renderer);
+			return -1;
+		}
+	}
+	// e.g. one overlay shader without the other
+	release_pipeline_sources(&sources);
+	// the ring is made whenever the overlay can be drawn, so O can turn it on later
+	if (renderer.overlay_available && !create_overlay_ring(&renderer)) {
+		renderer.overlay_available = false;
+	}
+	if (options.overlay && !renderer.overlay_available) {
+		printf("The overlay is not available, are shaders/overlay_vert.spv and overlay_frag.spv built?\n");
+		freeMemory(window, &renderer);
+		return -1;
+	}
+	renderer.overlay_enabled = options.overlay && renderer.overlay_available;
+	if (options.metrics_socket || options.metrics_file) {
+		renderer.metrics_enabled = metrics_server_start(&renderer.metrics, options.metrics_socket, options.metrics_file);
+	}
+	printf("Startup finished in %.1f ms. Startup arena peak: %zu bytes.\n",
+		(now_seconds() - launch_time) * 1000.0, renderer.startup_arena.high_water);
+
+	struct RenderLoop loop = {
+		.renderer = &renderer,
+		.options = &options,
+	};
+	struct InputState input = {
+		.scene = options.scene,
+		.shader_features = options.shader_features,
+		.overlay = renderer.overlay_enabled,
+		.mesh_enabled = renderer.mesh_enabled,
+	};
+	triple_buffer_init(&loop.packets);
+	for (uint32_t i = 0; i < TRIPLE_BUFFER_SLOTS; i++) {
+		loop.packet_slots[i].scene = options.scene;
+		loop.packet_slots[i].shader_features = options.shader_features;
+		loop.packet_slots[i].overlay = renderer.overlay_enabled;
+	}
+	atomic_init(&loop.running, true);
+
+	if (renderer.headless) {
+		// no input to stay responsive to, render on this thread
+		render_thread(&loop);
+	} else {
+		pthread_t render;
+		if (pthread_create(&render, NULL, render_thread, &loop) != 0) {
+			printf("Failed to start the render thread.\n");
+			freeMemory(window, &renderer);
+			return -1;
+		}
+		glfwSetWindowUserPointer(window, &input);
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetMouseButtonCallback(window, mouse_button_callback);
+		// input and update rate, independent of how fast frames are presented
+		while (atomic_load(&loop.running) && !glfwWindowShouldClose(window)) {
+			glfwWaitEventsTimeout(UPDATE_INTERVAL);
+			publish_frame_packet(&loop, &input);
+		}
+		atomic_store(&loop.running, false);
+		pthread_join(render, NULL);
 	}
 	vkDeviceWaitIdle(renderer.logical_device);
+
+	bool passed = true;
+	if (options.max_frame_ms > 0.0 && loop.frame_ms > options.max_frame_ms) {
+		printf("Frame time budget of %.3f ms exceeded.\n", options.max_frame_ms);
+		passed = false;
+	}
+	if (options.golden_path && !check_golden(&renderer, &options)) {
+		passed = false;
+	}
 	freeMemory(window, &renderer);
-	return 0;
+	return passed ? 0 : 1;
 }
@@ -0,0 +1,75 @@
+#include "malloc_count.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef __GLIBC__
+
+// An executable that defines malloc replaces it for every library it loads,
+// and glibc calls it through the replacement too. These forward to glibc's
+// own allocator, so its free() still pairs with them.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static atomic_uint_fast64_t malloc_calls;
+
+static void count_call() {
+	atomic_fetch_add_explicit(&malloc_calls, 1, memory_order_relaxed);
+}
+
+void* malloc(size_t size) {
+	count_call();
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+	count_call();
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	count_call();
+	return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	count_call();
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+	count_call();
+	if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	void* ptr = __libc_memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*out = ptr;
+	return 0;
+}
+
+bool malloc_counting() {
+	return true;
+}
+
+uint64_t malloc_call_count() {
+	return atomic_load_explicit(&malloc_calls, memory_order_relaxed);
+}
+
+#else
+
+bool malloc_counting() {
+	return false;
+}
+
+uint64_t malloc_call_count() {
+	return 0;
+}
+
+#endif
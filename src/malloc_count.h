@@ -0,0 +1,13 @@
+#ifndef MALLOC_COUNT_H
+#define MALLOC_COUNT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Calls to malloc, calloc, realloc and the aligned allocators made anywhere in
+// the process: the renderer, libc itself, GLFW and the Vulkan driver. Only
+// counted where the C library lets the executable replace malloc.
+bool malloc_counting();
+uint64_t malloc_call_count();
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MESH_MAX_LODS 8
+
+// A detail level: a range of the shared index buffer over the shared vertices.
+// error is the object space distance the level may deviate from the full mesh.
+struct MeshLod {
+	uint32_t index_offset;
+	uint32_t index_count;
+	float error;
+	uint32_t reserved;
+};
+
+// Indexed triangle list as imported, before quantization. Level 0 is the full
+// mesh, coarser levels follow it in the same index array.
+struct Mesh {
+	float* positions;
+	float* normals;
+	uint32_t vertex_count;
+	uint32_t* indices;
+	uint32_t index_count;
+	struct MeshLod lods[MESH_MAX_LODS];
+	uint32_t lod_count;
+};
+
+// Imports an .obj, .gltf or .glb file by extension. glTF node transforms are
+// not applied, every triangle primitive of every mesh is merged as stored.
+bool mesh_import(const char* path, struct Mesh* mesh);
+bool mesh_import_obj(const char* path, struct Mesh* mesh);
+bool mesh_import_gltf(const char* path, struct Mesh* mesh);
+// Area weighted vertex normals, for files that come without them.
+void mesh_compute_normals(struct Mesh* mesh);
+void mesh_free(struct Mesh* mesh);
+
+// Preprocessing, run in this order. The vertex cache pass reorders triangles
+// for a small post-transform cache, the overdraw pass then reorders clusters of
+// them so outward facing ones are drawn first, and the fetch pass renumbers
+// vertices in the order the indices first reference them.
+void mesh_optimize_vertex_cache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+void mesh_optimize_overdraw(uint32_t* indices, uint32_t index_count, const float* positions, uint32_t vertex_count);
+void mesh_optimize_vertex_fetch(struct Mesh* mesh);
+// Quadric error edge collapse (Garland and Heckbert) towards target_index_count,
+// collapsing vertices onto existing ones so every level can share one vertex
+// buffer. Vertices at the same position collapse together so seams stay closed,
+// and open borders are kept in place. Writes the result to destination, which
+// needs index_count entries, and returns its index count. *error receives the
+// largest deviation introduced, in object space units.
+uint32_t mesh_simplify(uint32_t* destination, const uint32_t* indices, uint32_t index_count,
+	const float* positions, uint32_t vertex_count, uint32_t target_index_count, float* error);
+// Appends coarser levels to mesh until max_lods exist or simplification stops
+// making progress, each aiming for half the triangles of the one before.
+void mesh_generate_lods(struct Mesh* mesh, uint32_t max_lods);
+// Average cache misses per triangle for a FIFO cache of cache_size entries.
+// 0.5 is the ideal for a regular grid, 3 means no reuse at all.
+float mesh_vertex_cache_acmr(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size);
+
+#define MESH_FILE_MAGIC 0x48534d56u
+#define MESH_FILE_VERSION 2
+#define MESH_FILE_ALIGNMENT 16
+
+// Quantized vertex as stored in mesh files and vertex buffers, 12 bytes.
+// Positions are unorm16 over the bounding box, normals are octahedral snorm16.
+struct PackedVertex {
+	uint16_t position[4];
+	int16_t normal[2];
+};
+
+// Mesh file layout, little endian: this header, then vertex_count packed
+// vertices at vertex_offset and index_count indices of index_size bytes at
+// index_offset, the ranges of every detail level back to back. Both offsets are
+// MESH_FILE_ALIGNMENT aligned, so a mapped file can be copied into GPU buffers
+// as is.
+struct MeshFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t index_size;
+	uint32_t lod_count;
+	// object space position = bounds_min + unorm position * bounds_extent
+	float bounds_min[3];
+	float bounds_extent[3];
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	struct MeshLod lods[MESH_MAX_LODS];
+};
+
+// Quantizes the mesh and writes it. Indices are stored as 16 bits when every
+// vertex can be addressed that way.
+bool mesh_write(const char* path, const struct Mesh* mesh);
+
+struct MappedMesh {
+	void* base;
+	size_t size;
+	const struct MeshFileHeader* header;
+	const struct PackedVertex* vertices;
+	const void* indices;
+};
+
+// Maps a mesh file read-only and checks that its header describes data inside the
+// file and that every index refers to one of its vertices.
+bool mesh_map(const char* path, struct MappedMesh* mapped);
+void mesh_unmap(struct MappedMesh* mapped);
+
+#endif
@@ -0,0 +1,200 @@
+#include "mesh.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+static uint64_t align_offset(uint64_t offset) {
+	return (offset + MESH_FILE_ALIGNMENT - 1) & ~(uint64_t) (MESH_FILE_ALIGNMENT - 1);
+}
+
+static int16_t quantize_snorm16(float value) {
+	value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+	return (int16_t) lroundf(value * 32767.0f);
+}
+
+// Octahedral encoding: the unit sphere is projected onto an octahedron and the
+// lower half folded over the upper one, which maps the direction onto a square.
+static void encode_octahedral(const float* normal, int16_t* out) {
+	float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	float x = length > 0.0f ? normal[0] / length : 0.0f;
+	float y = length > 0.0f ? normal[1] / length : 0.0f;
+	if (length > 0.0f && normal[2] < 0.0f) {
+		float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+	out[0] = quantize_snorm16(x);
+	out[1] = quantize_snorm16(y);
+}
+
+static bool write_padding(FILE* fp, uint64_t written, uint64_t offset) {
+	static const uint8_t zeros[MESH_FILE_ALIGNMENT] = {};
+	return offset == written || fwrite(zeros, offset - written, 1, fp) == 1;
+}
+
+bool mesh_write(const char* path, const struct Mesh* mesh) {
+	struct MeshFileHeader header = {
+		.magic = MESH_FILE_MAGIC,
+		.version = MESH_FILE_VERSION,
+		.vertex_count = mesh->vertex_count,
+		.index_count = mesh->index_count,
+		.index_size = mesh->vertex_count <= 65536 ? 2 : 4,
+		.lod_count = mesh->lod_count,
+	};
+	memcpy(header.lods, mesh->lods, sizeof(header.lods));
+	float bounds_max[3];
+	for (uint32_t k = 0; k < 3; k++) {
+		header.bounds_min[k] = mesh->vertex_count ? mesh->positions[k] : 0.0f;
+		bounds_max[k] = header.bounds_min[k];
+	}
+	for (uint32_t v = 0; v < mesh->vertex_count; v++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			float p = mesh->positions[v * 3 + k];
+			header.bounds_min[k] = p < header.bounds_min[k] ? p : header.bounds_min[k];
+			bounds_max[k] = p > bounds_max[k] ? p : bounds_max[k];
+		}
+	}
+	for (uint32_t k = 0; k < 3; k++) {
+		header.bounds_extent[k] = bounds_max[k] - header.bounds_min[k];
+	}
+	header.vertex_offset = align_offset(sizeof(header));
+	header.index_offset = align_offset(header.vertex_offset + (uint64_t) mesh->vertex_count * sizeof(struct PackedVertex));
+
+	size_t vertex_bytes = sizeof(struct PackedVertex) * mesh->vertex_count;
+	size_t index_bytes = (size_t) header.index_size * mesh->index_count;
+	struct PackedVertex* vertices = heap_alloc(vertex_bytes ? vertex_bytes : 1);
+	uint8_t* indices = heap_alloc(index_bytes ? index_bytes : 1);
+	if (!vertices || !indices) {
+		printf("Failed to allocate %zu bytes for the packed mesh.\n", vertex_bytes + index_bytes);
+		heap_free(vertices);
+		heap_free(indices);
+		return false;
+	}
+	for (uint32_t v = 0; v < mesh->vertex_count; v++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			float extent = header.bounds_extent[k];
+			float unit = extent > 0.0f ? (mesh->positions[v * 3 + k] - header.bounds_min[k]) / extent : 0.0f;
+			vertices[v].position[k] = (uint16_t) lroundf(unit * 65535.0f);
+		}
+		vertices[v].position[3] = 0;
+		encode_octahedral(mesh->normals + v * 3, vertices[v].normal);
+	}
+	for (uint32_t i = 0; i < mesh->index_count; i++) {
+		if (header.index_size == 2) {
+			uint16_t index = mesh->indices[i];
+			memcpy(indices + i * 2, &index, 2);
+		} else {
+			memcpy(indices + i * 4, &mesh->indices[i], 4);
+		}
+	}
+
+	FILE* fp = fopen(path, "wb");
+	bool ok = fp != NULL;
+	ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && write_padding(fp, sizeof(header), header.vertex_offset);
+	ok = ok && (vertex_bytes == 0 || fwrite(vertices, vertex_bytes, 1, fp) == 1);
+	ok = ok && write_padding(fp, header.vertex_offset + vertex_bytes, header.index_offset);
+	ok = ok && (index_bytes == 0 || fwrite(indices, index_bytes, 1, fp) == 1);
+	if (fp != NULL && fclose(fp) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		printf("Failed to write %s\n", path);
+	}
+	heap_free(vertices);
+	heap_free(indices);
+	return ok;
+}
+
+static bool lods_in_range(const struct MeshFileHeader* header) {
+	if (header->lod_count == 0 || header->lod_count > MESH_MAX_LODS) {
+		return false;
+	}
+	for (uint32_t i = 0; i < header->lod_count; i++) {
+		const struct MeshLod* lod = &header->lods[i];
+		if (lod->index_count == 0 || lod->index_count % 3 != 0 ||
+			(uint64_t) lod->index_offset + lod->index_count > header->index_count) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// An index past the vertex buffer would have the GPU read outside it.
+static bool indices_in_range(const struct MeshFileHeader* header, const void* indices) {
+	uint32_t largest = 0;
+	if (header->index_size == 2) {
+		const uint16_t* values = indices;
+		for (uint32_t i = 0; i < header->index_count; i++) {
+			largest = values[i] > largest ? values[i] : largest;
+		}
+	} else {
+		const uint32_t* values = indices;
+		for (uint32_t i = 0; i < header->index_count; i++) {
+			largest = values[i] > largest ? values[i] : largest;
+		}
+	}
+	return header->index_count == 0 || largest < header->vertex_count;
+}
+
+bool mesh_map(const char* path, struct MappedMesh* mapped) {
+	memset(mapped, 0, sizeof(*mapped));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Failed to open %s\n", path);
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(struct MeshFileHeader)) {
+		printf("%s is too small to be a mesh file.\n", path);
+		close(fd);
+		return false;
+	}
+	void* base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file alive
+	close(fd);
+	if (base == MAP_FAILED) {
+		printf("Failed to map %s\n", path);
+		return false;
+	}
+	mapped->base = base;
+	mapped->size = info.st_size;
+
+	const struct MeshFileHeader* header = base;
+	uint64_t vertex_end = header->vertex_offset + (uint64_t) header->vertex_count * sizeof(struct PackedVertex);
+	uint64_t index_end = header->index_offset + (uint64_t) header->index_count * header->index_size;
+	if (header->magic != MESH_FILE_MAGIC || header->version != MESH_FILE_VERSION) {
+		printf("%s is not a version %d mesh file.\n", path, MESH_FILE_VERSION);
+	} else if ((header->index_size != 2 && header->index_size != 4) ||
+		header->vertex_offset > mapped->size || header->index_offset > mapped->size ||
+		header->vertex_offset % MESH_FILE_ALIGNMENT != 0 || header->index_offset % MESH_FILE_ALIGNMENT != 0 ||
+		vertex_end > mapped->size || index_end > mapped->size) {
+		printf("%s is truncated or corrupt.\n", path);
+	} else if (!lods_in_range(header)) {
+		printf("%s has invalid detail levels.\n", path);
+	} else if (!indices_in_range(header, (const uint8_t*) base + header->index_offset)) {
+		printf("%s has indices past its %u vertices.\n", path, header->vertex_count);
+	} else {
+		mapped->header = header;
+		mapped->vertices = (const struct PackedVertex*) ((const uint8_t*) base + header->vertex_offset);
+		mapped->indices = (const uint8_t*) base + header->index_offset;
+		return true;
+	}
+	mesh_unmap(mapped);
+	return false;
+}
+
+void mesh_unmap(struct MappedMesh* mapped) {
+	if (mapped->base) {
+		munmap(mapped->base, mapped->size);
+	}
+	memset(mapped, 0, sizeof(*mapped));
+}
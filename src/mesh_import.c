@@ -0,0 +1,611 @@
+#include "mesh.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "arena.h"
+#include "json.h"
+
+// Whole file, NUL terminated so text formats can be parsed in place.
+static char* read_whole_file(const char* path, size_t* size) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Failed to open %s\n", path);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char* data = length >= 0 ? heap_alloc(length + 1) : NULL;
+	if (data && length > 0 && fread(data, length, 1, fp) != 1) {
+		heap_free(data);
+		data = NULL;
+	}
+	fclose(fp);
+	if (!data) {
+		printf("Failed to read %s\n", path);
+		return NULL;
+	}
+	data[length] = '\0';
+	*size = length;
+	return data;
+}
+
+static bool has_extension(const char* path, const char* extension) {
+	size_t path_length = strlen(path);
+	size_t extension_length = strlen(extension);
+	return path_length >= extension_length && strcasecmp(path + path_length - extension_length, extension) == 0;
+}
+
+bool mesh_import(const char* path, struct Mesh* mesh) {
+	memset(mesh, 0, sizeof(*mesh));
+	bool imported = false;
+	if (has_extension(path, ".obj")) {
+		imported = mesh_import_obj(path, mesh);
+	} else if (has_extension(path, ".gltf") || has_extension(path, ".glb")) {
+		imported = mesh_import_gltf(path, mesh);
+	} else {
+		printf("Unsupported mesh format: %s\n", path);
+	}
+	if (imported) {
+		mesh->lods[0] = (struct MeshLod) {.index_offset = 0, .index_count = mesh->index_count};
+		mesh->lod_count = 1;
+	}
+	return imported;
+}
+
+static bool allocate_mesh(struct Mesh* mesh, uint32_t vertex_capacity, uint32_t index_capacity) {
+	mesh->positions = heap_alloc(sizeof(float) * 3 * vertex_capacity);
+	mesh->normals = heap_alloc(sizeof(float) * 3 * vertex_capacity);
+	mesh->indices = heap_alloc(sizeof(uint32_t) * index_capacity);
+	mesh->vertex_count = 0;
+	mesh->index_count = 0;
+	if (!mesh->positions || !mesh->normals || !mesh->indices) {
+		printf("Failed to allocate a mesh of %u indices.\n", index_capacity);
+		mesh_free(mesh);
+		return false;
+	}
+	return true;
+}
+
+void mesh_free(struct Mesh* mesh) {
+	heap_free(mesh->positions);
+	heap_free(mesh->normals);
+	heap_free(mesh->indices);
+	memset(mesh, 0, sizeof(*mesh));
+}
+
+void mesh_compute_normals(struct Mesh* mesh) {
+	memset(mesh->normals, 0, sizeof(float) * 3 * mesh->vertex_count);
+	for (uint32_t i = 0; i + 2 < mesh->index_count; i += 3) {
+		const float* p0 = mesh->positions + mesh->indices[i] * 3;
+		const float* p1 = mesh->positions + mesh->indices[i + 1] * 3;
+		const float* p2 = mesh->positions + mesh->indices[i + 2] * 3;
+		float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+		float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+		// not normalized, so larger triangles weigh more
+		float n[3] = {
+			e1[1] * e2[2] - e1[2] * e2[1],
+			e1[2] * e2[0] - e1[0] * e2[2],
+			e1[0] * e2[1] - e1[1] * e2[0],
+		};
+		for (uint32_t k = 0; k < 3; k++) {
+			float* normal = mesh->normals + mesh->indices[i + k] * 3;
+			normal[0] += n[0];
+			normal[1] += n[1];
+			normal[2] += n[2];
+		}
+	}
+	for (uint32_t v = 0; v < mesh->vertex_count; v++) {
+		float* normal = mesh->normals + v * 3;
+		float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length > 0.0f) {
+			normal[0] /= length;
+			normal[1] /= length;
+			normal[2] /= length;
+		} else {
+			normal[0] = 0.0f;
+			normal[1] = 0.0f;
+			normal[2] = 1.0f;
+		}
+	}
+}
+
+// OBJ
+
+static bool is_line_start(const char* line, const char* keyword) {
+	size_t length = strlen(keyword);
+	return strncmp(line, keyword, length) == 0 && (line[length] == ' ' || line[length] == '\t');
+}
+
+static const char* next_line(const char* at) {
+	while (*at && *at != '\n') {
+		at++;
+	}
+	return *at ? at + 1 : at;
+}
+
+// OBJ indices are 1 based, negative ones count back from the newest element.
+static bool resolve_obj_index(long index, uint32_t count, uint32_t* resolved) {
+	long value = index < 0 ? (long) count + index : index - 1;
+	if (index == 0 || value < 0 || value >= (long) count) {
+		return false;
+	}
+	*resolved = value;
+	return true;
+}
+
+// Open addressing map from an OBJ (position, normal) pair to its mesh vertex.
+struct ObjVertexMap {
+	uint64_t* keys;
+	uint32_t* values;
+	uint32_t mask;
+};
+
+static uint32_t obj_vertex(struct ObjVertexMap* map, struct Mesh* mesh, const float* positions,
+	const float* normals, uint32_t position, uint32_t normal) {
+	uint64_t key = ((uint64_t) position << 32 | normal) + 1;
+	uint64_t hash = key * 0x9e3779b97f4a7c15ull;
+	for (uint32_t slot = (hash >> 32) & map->mask;; slot = (slot + 1) & map->mask) {
+		if (map->keys[slot] == key) {
+			return map->values[slot];
+		}
+		if (map->keys[slot] == 0) {
+			uint32_t vertex = mesh->vertex_count++;
+			memcpy(mesh->positions + vertex * 3, positions + position * 3, sizeof(float) * 3);
+			if (normals && normal != UINT32_MAX) {
+				memcpy(mesh->normals + vertex * 3, normals + normal * 3, sizeof(float) * 3);
+			}
+			map->keys[slot] = key;
+			map->values[slot] = vertex;
+			return vertex;
+		}
+	}
+}
+
+bool mesh_import_obj(const char* path, struct Mesh* mesh) {
+	size_t size = 0;
+	char* text = read_whole_file(path, &size);
+	if (!text) {
+		return false;
+	}
+
+	// first pass sizes every array, so the second can fill them without growing
+	uint32_t position_count = 0;
+	uint32_t normal_count = 0;
+	uint64_t index_count = 0;
+	for (const char* line = text; *line; line = next_line(line)) {
+		if (is_line_start(line, "v")) {
+			position_count++;
+		} else if (is_line_start(line, "vn")) {
+			normal_count++;
+		} else if (is_line_start(line, "f")) {
+			uint32_t corners = 0;
+			const char* at = line + 1;
+			while (*at && *at != '\n') {
+				while (*at == ' ' || *at == '\t' || *at == '\r') {
+					at++;
+				}
+				if (*at && *at != '\n') {
+					corners++;
+				}
+				while (*at && *at != ' ' && *at != '\t' && *at != '\r' && *at != '\n') {
+					at++;
+				}
+			}
+			if (corners >= 3) {
+				index_count += (corners - 2) * 3;
+			}
+		}
+	}
+	// the vertex map below is sized at twice the index count
+	if (index_count == 0 || index_count > UINT32_MAX / 4) {
+		printf("%s has no usable faces.\n", path);
+		heap_free(text);
+		return false;
+	}
+
+	float* positions = heap_alloc(sizeof(float) * 3 * (position_count ? position_count : 1));
+	float* normals = heap_alloc(sizeof(float) * 3 * (normal_count ? normal_count : 1));
+	uint32_t map_size = 1;
+	while (map_size < index_count * 2) {
+		map_size <<= 1;
+	}
+	struct ObjVertexMap map = {
+		.keys = heap_alloc(sizeof(uint64_t) * map_size),
+		.values = heap_alloc(sizeof(uint32_t) * map_size),
+		.mask = map_size - 1,
+	};
+	bool ok = positions && normals && map.keys && map.values &&
+		allocate_mesh(mesh, index_count, index_count);
+	if (ok) {
+		memset(map.keys, 0, sizeof(uint64_t) * map_size);
+	}
+
+	bool has_normals = normal_count > 0;
+	uint32_t positions_read = 0;
+	uint32_t normals_read = 0;
+	uint32_t written = 0;
+	for (const char* line = text; ok && *line; line = next_line(line)) {
+		if (is_line_start(line, "v") || is_line_start(line, "vn")) {
+			bool is_normal = line[1] == 'n';
+			float* out = is_normal ? normals + normals_read++ * 3 : positions + positions_read++ * 3;
+			char* at = (char*) line + (is_normal ? 2 : 1);
+			for (uint32_t k = 0; k < 3; k++) {
+				out[k] = strtof(at, &at);
+			}
+		} else if (is_line_start(line, "f")) {
+			char* at = (char*) line + 1;
+			uint32_t first = 0;
+			uint32_t previous = 0;
+			uint32_t corner = 0;
+			for (;;) {
+				while (*at == ' ' || *at == '\t' || *at == '\r') {
+					at++;
+				}
+				if (!*at || *at == '\n') {
+					break;
+				}
+				uint32_t position = 0;
+				uint32_t normal = UINT32_MAX;
+				if (!resolve_obj_index(strtol(at, &at, 10), positions_read, &position)) {
+					printf("%s: face references a missing position.\n", path);
+					ok = false;
+					break;
+				}
+				if (*at == '/') {
+					at++;
+					if (*at != '/') {
+						strtol(at, &at, 10);
+					}
+					if (*at == '/') {
+						at++;
+						if (!resolve_obj_index(strtol(at, &at, 10), normals_read, &normal)) {
+							normal = UINT32_MAX;
+						}
+					}
+				}
+				if (normal == UINT32_MAX) {
+					has_normals = false;
+				}
+				while (*at && *at != ' ' && *at != '\t' && *at != '\r' && *at != '\n') {
+					at++;
+				}
+				uint32_t vertex = obj_vertex(&map, mesh, positions, normals, position, normal);
+				// polygons are triangulated as a fan around their first corner
+				if (corner == 0) {
+					first = vertex;
+				} else if (corner >= 2) {
+					mesh->indices[written++] = first;
+					mesh->indices[written++] = previous;
+					mesh->indices[written++] = vertex;
+				}
+				previous = vertex;
+				corner++;
+			}
+		}
+	}
+	mesh->index_count = written;
+
+	heap_free(map.keys);
+	heap_free(map.values);
+	heap_free(positions);
+	heap_free(normals);
+	heap_free(text);
+	if (!ok) {
+		mesh_free(mesh);
+		return false;
+	}
+	if (!has_normals) {
+		mesh_compute_normals(mesh);
+	}
+	return true;
+}
+
+// glTF
+
+#define GLB_MAGIC 0x46546c67u
+#define GLB_CHUNK_JSON 0x4e4f534au
+#define GLB_CHUNK_BIN 0x004e4942u
+
+enum GltfComponentType {
+	GLTF_UNSIGNED_BYTE = 5121,
+	GLTF_UNSIGNED_SHORT = 5123,
+	GLTF_UNSIGNED_INT = 5125,
+	GLTF_FLOAT = 5126,
+};
+
+struct GltfBuffer {
+	const uint8_t* data;
+	size_t size;
+	// heap block to free, NULL for the GLB binary chunk
+	uint8_t* owned;
+};
+
+struct GltfDocument {
+	struct JsonValue* root;
+	struct GltfBuffer* buffers;
+	uint32_t buffer_count;
+};
+
+// Elements of one accessor, after bounds checks against its buffer.
+struct GltfAccessor {
+	const uint8_t* data;
+	uint32_t count;
+	uint32_t stride;
+	uint32_t component_type;
+};
+
+static int base64_value(char c) {
+	if (c >= 'A' && c <= 'Z') return c - 'A';
+	if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+	if (c >= '0' && c <= '9') return c - '0' + 52;
+	if (c == '+') return 62;
+	if (c == '/') return 63;
+	return -1;
+}
+
+static uint8_t* decode_base64(const char* text, size_t* size) {
+	size_t length = strlen(text);
+	uint8_t* out = heap_alloc(length / 4 * 3 + 3);
+	if (!out) {
+		return NULL;
+	}
+	uint32_t bits = 0;
+	int bit_count = 0;
+	*size = 0;
+	for (const char* c = text; *c && *c != '='; c++) {
+		int value = base64_value(*c);
+		if (value < 0) {
+			continue;
+		}
+		bits = bits << 6 | value;
+		bit_count += 6;
+		if (bit_count >= 8) {
+			bit_count -= 8;
+			out[(*size)++] = bits >> bit_count;
+		}
+	}
+	return out;
+}
+
+static bool load_gltf_buffer(const char* gltf_path, struct JsonValue* description, struct GltfBuffer* buffer) {
+	const char* uri = json_string(json_member(description, "uri"));
+	if (!uri) {
+		// only the GLB binary chunk has no URI, and it was filled in already
+		return buffer->data != NULL;
+	}
+	size_t size = 0;
+	if (strncmp(uri, "data:", 5) == 0) {
+		const char* payload = strstr(uri, ";base64,");
+		if (!payload) {
+			printf("Unsupported glTF data URI.\n");
+			return false;
+		}
+		buffer->owned = decode_base64(payload + 8, &size);
+	} else {
+		// external files are relative to the .gltf, percent escapes are not decoded
+		const char* slash = strrchr(gltf_path, '/');
+		size_t directory_length = slash ? (size_t) (slash - gltf_path + 1) : 0;
+		char* path = heap_alloc(directory_length + strlen(uri) + 1);
+		if (!path) {
+			return false;
+		}
+		memcpy(path, gltf_path, directory_length);
+		strcpy(path + directory_length, uri);
+		buffer->owned = (uint8_t*) read_whole_file(path, &size);
+		heap_free(path);
+	}
+	if (!buffer->owned) {
+		return false;
+	}
+	size_t declared = (size_t) json_number(json_member(description, "byteLength"), 0.0);
+	buffer->data = buffer->owned;
+	buffer->size = declared < size ? declared : size;
+	return true;
+}
+
+static uint32_t component_size(uint32_t component_type) {
+	switch (component_type) {
+		case GLTF_UNSIGNED_BYTE: return 1;
+		case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT: return 4;
+		case GLTF_FLOAT: return 4;
+	}
+	return 0;
+}
+
+static bool read_gltf_accessor(struct GltfDocument* document, struct JsonValue* index, uint32_t components,
+	struct GltfAccessor* accessor) {
+	struct JsonValue* description = json_index(json_member(document->root, "accessors"),
+		(uint32_t) json_number(index, -1.0));
+	if (!description) {
+		return false;
+	}
+	accessor->count = (uint32_t) json_number(json_member(description, "count"), 0.0);
+	accessor->component_type = (uint32_t) json_number(json_member(description, "componentType"), 0.0);
+	uint32_t element_size = component_size(accessor->component_type) * components;
+	struct JsonValue* view = json_index(json_member(document->root, "bufferViews"),
+		(uint32_t) json_number(json_member(description, "bufferView"), -1.0));
+	uint32_t buffer_index = (uint32_t) json_number(json_member(view, "buffer"), -1.0);
+	if (!view || element_size == 0 || buffer_index >= document->buffer_count) {
+		// sparse accessors and accessors without a view are not supported
+		return false;
+	}
+	struct GltfBuffer* buffer = &document->buffers[buffer_index];
+	size_t offset = (size_t) json_number(json_member(view, "byteOffset"), 0.0) +
+		(size_t) json_number(json_member(description, "byteOffset"), 0.0);
+	size_t view_end = (size_t) json_number(json_member(view, "byteOffset"), 0.0) +
+		(size_t) json_number(json_member(view, "byteLength"), 0.0);
+	accessor->stride = (uint32_t) json_number(json_member(view, "byteStride"), element_size);
+	if (accessor->stride < element_size) {
+		return false;
+	}
+	if (accessor->count > 0 && (view_end > buffer->size ||
+		offset + (size_t) (accessor->count - 1) * accessor->stride + element_size > view_end)) {
+		printf("glTF accessor reaches past its buffer.\n");
+		return false;
+	}
+	accessor->data = buffer->data + offset;
+	return true;
+}
+
+static uint32_t accessor_index(struct GltfAccessor* accessor, uint32_t i) {
+	const uint8_t* element = accessor->data + (size_t) i * accessor->stride;
+	switch (accessor->component_type) {
+		case GLTF_UNSIGNED_BYTE: return element[0];
+		case GLTF_UNSIGNED_SHORT: {
+			uint16_t value;
+			memcpy(&value, element, sizeof(value));
+			return value;
+		}
+		default: {
+			uint32_t value;
+			memcpy(&value, element, sizeof(value));
+			return value;
+		}
+	}
+}
+
+// Visits every triangle primitive. With mesh NULL only the totals are counted.
+static bool gather_gltf_primitives(struct GltfDocument* document, struct Mesh* mesh,
+	uint64_t* vertex_total, uint64_t* index_total, bool* has_normals) {
+	struct JsonValue* meshes = json_member(document->root, "meshes");
+	for (uint32_t m = 0; meshes && m < meshes->count; m++) {
+		struct JsonValue* primitives = json_member(json_index(meshes, m), "primitives");
+		for (uint32_t p = 0; primitives && p < primitives->count; p++) {
+			struct JsonValue* primitive = json_index(primitives, p);
+			if (json_number(json_member(primitive, "mode"), 4.0) != 4.0) {
+				printf("Skipping a glTF primitive that is not a triangle list.\n");
+				continue;
+			}
+			struct JsonValue* attributes = json_member(primitive, "attributes");
+			struct GltfAccessor positions = {};
+			if (!read_gltf_accessor(document, json_member(attributes, "POSITION"), 3, &positions) ||
+				positions.component_type != GLTF_FLOAT) {
+				printf("glTF primitive %u of mesh %u has no usable float positions.\n", p, m);
+				return false;
+			}
+			struct GltfAccessor normals = {};
+			bool primitive_normals = json_member(attributes, "NORMAL") &&
+				read_gltf_accessor(document, json_member(attributes, "NORMAL"), 3, &normals) &&
+				normals.component_type == GLTF_FLOAT && normals.count == positions.count;
+			struct GltfAccessor indices = {};
+			bool indexed = json_member(primitive, "indices") != NULL;
+			if (indexed && (!read_gltf_accessor(document, json_member(primitive, "indices"), 1, &indices) ||
+				indices.component_type == GLTF_FLOAT)) {
+				printf("glTF primitive %u of mesh %u has unusable indices.\n", p, m);
+				return false;
+			}
+			uint32_t primitive_indices = (indexed ? indices.count : positions.count) / 3 * 3;
+
+			if (!mesh) {
+				*vertex_total += positions.count;
+				*index_total += primitive_indices;
+				*has_normals = *has_normals && primitive_normals;
+				continue;
+			}
+			uint32_t base = mesh->vertex_count;
+			for (uint32_t v = 0; v < positions.count; v++) {
+				memcpy(mesh->positions + (base + v) * 3, positions.data + (size_t) v * positions.stride, sizeof(float) * 3);
+				if (primitive_normals) {
+					memcpy(mesh->normals + (base + v) * 3, normals.data + (size_t) v * normals.stride, sizeof(float) * 3);
+				}
+			}
+			for (uint32_t i = 0; i < primitive_indices; i++) {
+				uint32_t index = indexed ? accessor_index(&indices, i) : i;
+				if (index >= positions.count) {
+					printf("glTF primitive %u of mesh %u indexes past its vertices.\n", p, m);
+					return false;
+				}
+				mesh->indices[mesh->index_count++] = base + index;
+			}
+			mesh->vertex_count += positions.count;
+		}
+	}
+	return true;
+}
+
+bool mesh_import_gltf(const char* path, struct Mesh* mesh) {
+	size_t size = 0;
+	char* file = read_whole_file(path, &size);
+	if (!file) {
+		return false;
+	}
+	const char* json = file;
+	size_t json_size = size;
+	struct GltfBuffer binary_chunk = {};
+	uint32_t magic = 0;
+	if (size >= 12) {
+		memcpy(&magic, file, sizeof(magic));
+	}
+	if (magic == GLB_MAGIC) {
+		// GLB: a JSON chunk, optionally followed by the binary chunk of buffer 0
+		uint32_t chunk[2];
+		json = NULL;
+		for (size_t offset = 12; offset + 8 <= size;) {
+			memcpy(chunk, file + offset, 8);
+			if (chunk[0] > size - offset - 8) {
+				break;
+			}
+			if (chunk[1] == GLB_CHUNK_JSON && !json) {
+				json = file + offset + 8;
+				json_size = chunk[0];
+			} else if (chunk[1] == GLB_CHUNK_BIN && !binary_chunk.data) {
+				binary_chunk.data = (const uint8_t*) file + offset + 8;
+				binary_chunk.size = chunk[0];
+			}
+			offset += 8 + ((chunk[0] + 3) & ~3u);
+		}
+		if (!json) {
+			printf("%s has no JSON chunk.\n", path);
+			heap_free(file);
+			return false;
+		}
+	}
+
+	// the parsed document, then the buffer table
+	struct Arena arena;
+	if (!arena_init(&arena, "gltf", json_arena_size(json, json_size) + 4096)) {
+		heap_free(file);
+		return false;
+	}
+	struct GltfDocument document = {
+		.root = json_parse(&arena, json, json_size),
+	};
+	struct JsonValue* buffers = json_member(document.root, "buffers");
+	document.buffer_count = buffers ? buffers->count : 0;
+	document.buffers = ARENA_ARRAY(&arena, struct GltfBuffer, document.buffer_count + 1);
+	bool ok = document.root != NULL && document.buffers != NULL;
+	for (uint32_t i = 0; ok && i < document.buffer_count; i++) {
+		document.buffers[i] = i == 0 ? binary_chunk : (struct GltfBuffer) {};
+		ok = load_gltf_buffer(path, json_index(buffers, i), &document.buffers[i]);
+	}
+
+	uint64_t vertex_total = 0;
+	uint64_t index_total = 0;
+	bool has_normals = true;
+	ok = ok && gather_gltf_primitives(&document, NULL, &vertex_total, &index_total, &has_normals);
+	if (ok && (index_total == 0 || vertex_total > UINT32_MAX || index_total > UINT32_MAX)) {
+		printf("%s has no usable triangles.\n", path);
+		ok = false;
+	}
+	ok = ok && allocate_mesh(mesh, vertex_total, index_total);
+	if (ok && !gather_gltf_primitives(&document, mesh, NULL, NULL, NULL)) {
+		mesh_free(mesh);
+		ok = false;
+	}
+
+	for (uint32_t i = 0; document.buffers && i < document.buffer_count; i++) {
+		heap_free(document.buffers[i].owned);
+	}
+	arena_destroy(&arena);
+	heap_free(file);
+	if (ok && !has_normals) {
+		mesh_compute_normals(mesh);
+	}
+	return ok;
+}
@@ -0,0 +1,323 @@
+#include "mesh.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation". The cache is modelled as
+// LRU; the order it produces works well for the FIFO caches of real hardware.
+#define VERTEX_CACHE_SIZE 32
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+// Cache size used to split triangles into clusters for the overdraw pass,
+// about what current hardware reuses.
+static const uint32_t OVERDRAW_CACHE_SIZE = 16;
+
+static float vertex_score(int32_t cache_position, uint32_t remaining) {
+	if (remaining == 0) {
+		// no triangle left to use it
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cache_position >= 0) {
+		if (cache_position < 3) {
+			// used by the last triangle, a fixed score keeps strips from bouncing
+			score = LAST_TRIANGLE_SCORE;
+		} else {
+			float scale = 1.0f / (VERTEX_CACHE_SIZE - 3);
+			score = powf(1.0f - (cache_position - 3) * scale, CACHE_DECAY_POWER);
+		}
+	}
+	// vertices with few triangles left are finished first so they leave the cache for good
+	return score + VALENCE_BOOST_SCALE * powf((float) remaining, -VALENCE_BOOST_POWER);
+}
+
+void mesh_optimize_vertex_cache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count) {
+	uint32_t triangle_count = index_count / 3;
+	if (triangle_count == 0) {
+		return;
+	}
+	uint32_t* valence = heap_alloc(sizeof(uint32_t) * vertex_count);
+	uint32_t* adjacency_offset = heap_alloc(sizeof(uint32_t) * (vertex_count + 1));
+	uint32_t* adjacency = heap_alloc(sizeof(uint32_t) * triangle_count * 3);
+	int32_t* cache_position = heap_alloc(sizeof(int32_t) * vertex_count);
+	float* score = heap_alloc(sizeof(float) * vertex_count);
+	float* triangle_score = heap_alloc(sizeof(float) * triangle_count);
+	bool* emitted = heap_alloc(sizeof(bool) * triangle_count);
+	uint32_t* output = heap_alloc(sizeof(uint32_t) * triangle_count * 3);
+	if (!valence || !adjacency_offset || !adjacency || !cache_position || !score || !triangle_score ||
+		!emitted || !output) {
+		printf("Not enough memory to optimize for the vertex cache.\n");
+		goto done;
+	}
+
+	// triangles of each vertex; valence[v] counts the ones not yet emitted,
+	// which are kept at the front of its range
+	memset(valence, 0, sizeof(uint32_t) * vertex_count);
+	for (uint32_t i = 0; i < triangle_count * 3; i++) {
+		valence[indices[i]]++;
+	}
+	adjacency_offset[0] = 0;
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		adjacency_offset[v + 1] = adjacency_offset[v] + valence[v];
+		valence[v] = 0;
+	}
+	for (uint32_t i = 0; i < triangle_count * 3; i++) {
+		uint32_t v = indices[i];
+		adjacency[adjacency_offset[v] + valence[v]++] = i / 3;
+	}
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		cache_position[v] = -1;
+		score[v] = vertex_score(-1, valence[v]);
+	}
+	uint32_t best = 0;
+	for (uint32_t t = 0; t < triangle_count; t++) {
+		emitted[t] = false;
+		triangle_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+		if (triangle_score[t] > triangle_score[best]) {
+			best = t;
+		}
+	}
+
+	uint32_t cache[VERTEX_CACHE_SIZE + 3];
+	uint32_t cache_count = 0;
+	uint32_t cursor = 0;
+	for (uint32_t written = 0; written < triangle_count; written++) {
+		if (best == UINT32_MAX) {
+			// dead end, nothing in the cache has triangles left; continue in input order
+			while (emitted[cursor]) {
+				cursor++;
+			}
+			best = cursor;
+		}
+		const uint32_t* triangle = indices + best * 3;
+		memcpy(output + written * 3, triangle, sizeof(uint32_t) * 3);
+		emitted[best] = true;
+
+		// move the triangle's vertices to the front of the cache, the rest keep their order
+		uint32_t new_cache[VERTEX_CACHE_SIZE + 3];
+		uint32_t new_count = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = triangle[k];
+			new_cache[new_count++] = v;
+			uint32_t* list = adjacency + adjacency_offset[v];
+			for (uint32_t a = 0; a < valence[v]; a++) {
+				if (list[a] == best) {
+					list[a] = list[--valence[v]];
+					break;
+				}
+			}
+		}
+		for (uint32_t c = 0; c < cache_count; c++) {
+			uint32_t v = cache[c];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+				new_cache[new_count++] = v;
+			}
+		}
+		for (uint32_t c = 0; c < new_count; c++) {
+			uint32_t v = new_cache[c];
+			cache_position[v] = c < VERTEX_CACHE_SIZE ? (int32_t) c : -1;
+			score[v] = vertex_score(cache_position[v], valence[v]);
+		}
+		cache_count = new_count < VERTEX_CACHE_SIZE ? new_count : VERTEX_CACHE_SIZE;
+		memcpy(cache, new_cache, sizeof(uint32_t) * cache_count);
+
+		// only triangles touching the cache changed score, and the next one comes from them
+		best = UINT32_MAX;
+		float best_score = -1.0f;
+		for (uint32_t c = 0; c < new_count; c++) {
+			uint32_t v = new_cache[c];
+			const uint32_t* list = adjacency + adjacency_offset[v];
+			for (uint32_t a = 0; a < valence[v]; a++) {
+				uint32_t t = list[a];
+				const uint32_t* corners = indices + t * 3;
+				triangle_score[t] = score[corners[0]] + score[corners[1]] + score[corners[2]];
+				if (c < VERTEX_CACHE_SIZE && triangle_score[t] > best_score) {
+					best_score = triangle_score[t];
+					best = t;
+				}
+			}
+		}
+	}
+	memcpy(indices, output, sizeof(uint32_t) * triangle_count * 3);
+
+done:
+	heap_free(valence);
+	heap_free(adjacency_offset);
+	heap_free(adjacency);
+	heap_free(cache_position);
+	heap_free(score);
+	heap_free(triangle_score);
+	heap_free(emitted);
+	heap_free(output);
+}
+
+float mesh_vertex_cache_acmr(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size) {
+	uint32_t triangle_count = index_count / 3;
+	uint32_t* timestamps = heap_alloc(sizeof(uint32_t) * vertex_count);
+	if (!timestamps || triangle_count == 0) {
+		heap_free(timestamps);
+		return 0.0f;
+	}
+	memset(timestamps, 0, sizeof(uint32_t) * vertex_count);
+	// a vertex is cached while fewer than cache_size misses happened since it was loaded
+	uint32_t timestamp = cache_size + 1;
+	uint32_t misses = 0;
+	for (uint32_t i = 0; i < triangle_count * 3; i++) {
+		uint32_t v = indices[i];
+		if (timestamp - timestamps[v] > cache_size) {
+			timestamps[v] = timestamp++;
+			misses++;
+		}
+	}
+	heap_free(timestamps);
+	return (float) misses / triangle_count;
+}
+
+struct TriangleCluster {
+	uint32_t start;
+	uint32_t count;
+	float sort_key;
+};
+
+static int compare_clusters(const void* a, const void* b) {
+	const struct TriangleCluster* left = a;
+	const struct TriangleCluster* right = b;
+	if (left->sort_key != right->sort_key) {
+		return left->sort_key > right->sort_key ? -1 : 1;
+	}
+	return left->start < right->start ? -1 : 1;
+}
+
+// Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw", simplified: the cache optimized order is cut into clusters
+// wherever a triangle misses the cache on all three vertices, so reordering
+// whole clusters costs almost no cache efficiency. Clusters that face away from
+// the mesh centre are drawn first, since they tend to occlude the rest from
+// any viewpoint.
+void mesh_optimize_overdraw(uint32_t* indices, uint32_t index_count, const float* positions, uint32_t vertex_count) {
+	uint32_t triangle_count = index_count / 3;
+	if (triangle_count < 2) {
+		return;
+	}
+	uint32_t* timestamps = heap_alloc(sizeof(uint32_t) * vertex_count);
+	struct TriangleCluster* clusters = heap_alloc(sizeof(struct TriangleCluster) * triangle_count);
+	uint32_t* output = heap_alloc(sizeof(uint32_t) * triangle_count * 3);
+	if (!timestamps || !clusters || !output) {
+		printf("Not enough memory to optimize for overdraw.\n");
+		goto done;
+	}
+
+	memset(timestamps, 0, sizeof(uint32_t) * vertex_count);
+	uint32_t timestamp = OVERDRAW_CACHE_SIZE + 1;
+	uint32_t cluster_count = 0;
+	for (uint32_t t = 0; t < triangle_count; t++) {
+		uint32_t misses = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = indices[t * 3 + k];
+			if (timestamp - timestamps[v] > OVERDRAW_CACHE_SIZE) {
+				timestamps[v] = timestamp++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) {
+			clusters[cluster_count].start = t;
+			clusters[cluster_count].count = 0;
+			cluster_count++;
+		}
+		clusters[cluster_count - 1].count++;
+	}
+
+	float mesh_centroid[3] = {};
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		mesh_centroid[0] += positions[v * 3];
+		mesh_centroid[1] += positions[v * 3 + 1];
+		mesh_centroid[2] += positions[v * 3 + 2];
+	}
+	for (uint32_t k = 0; k < 3; k++) {
+		mesh_centroid[k] /= vertex_count;
+	}
+
+	for (uint32_t c = 0; c < cluster_count; c++) {
+		float centroid[3] = {};
+		float normal[3] = {};
+		float area = 0.0f;
+		for (uint32_t t = clusters[c].start; t < clusters[c].start + clusters[c].count; t++) {
+			const float* p0 = positions + indices[t * 3] * 3;
+			const float* p1 = positions + indices[t * 3 + 1] * 3;
+			const float* p2 = positions + indices[t * 3 + 2] * 3;
+			float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0],
+			};
+			float triangle_area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (uint32_t k = 0; k < 3; k++) {
+				centroid[k] += (p0[k] + p1[k] + p2[k]) / 3.0f * triangle_area;
+				normal[k] += n[k];
+			}
+			area += triangle_area;
+		}
+		float normal_length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float key = 0.0f;
+		if (area > 0.0f && normal_length > 0.0f) {
+			for (uint32_t k = 0; k < 3; k++) {
+				key += (centroid[k] / area - mesh_centroid[k]) * normal[k] / normal_length;
+			}
+		}
+		clusters[c].sort_key = key;
+	}
+	qsort(clusters, cluster_count, sizeof(struct TriangleCluster), compare_clusters);
+
+	uint32_t written = 0;
+	for (uint32_t c = 0; c < cluster_count; c++) {
+		memcpy(output + written * 3, indices + clusters[c].start * 3, sizeof(uint32_t) * 3 * clusters[c].count);
+		written += clusters[c].count;
+	}
+	memcpy(indices, output, sizeof(uint32_t) * triangle_count * 3);
+
+done:
+	heap_free(timestamps);
+	heap_free(clusters);
+	heap_free(output);
+}
+
+void mesh_optimize_vertex_fetch(struct Mesh* mesh) {
+	uint32_t* remap = heap_alloc(sizeof(uint32_t) * mesh->vertex_count);
+	float* positions = heap_alloc(sizeof(float) * 3 * mesh->vertex_count);
+	float* normals = heap_alloc(sizeof(float) * 3 * mesh->vertex_count);
+	if (!remap || !positions || !normals) {
+		printf("Not enough memory to optimize vertex fetch.\n");
+		heap_free(remap);
+		heap_free(positions);
+		heap_free(normals);
+		return;
+	}
+	memset(remap, 0xff, sizeof(uint32_t) * mesh->vertex_count);
+	uint32_t next = 0;
+	for (uint32_t i = 0; i < mesh->index_count; i++) {
+		uint32_t v = mesh->indices[i];
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = next;
+			memcpy(positions + next * 3, mesh->positions + v * 3, sizeof(float) * 3);
+			memcpy(normals + next * 3, mesh->normals + v * 3, sizeof(float) * 3);
+			next++;
+		}
+		mesh->indices[i] = remap[v];
+	}
+	// vertices no triangle references are dropped
+	heap_free(mesh->positions);
+	heap_free(mesh->normals);
+	heap_free(remap);
+	mesh->positions = positions;
+	mesh->normals = normals;
+	mesh->vertex_count = next;
+}
@@ -0,0 +1,377 @@
+#include "mesh.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Simplification stops adding levels below this many triangles, and when a
+// level removes less than a tenth of the triangles of the one before.
+static const uint32_t LOD_MIN_TRIANGLES = 32;
+static const float LOD_MIN_REDUCTION = 0.9f;
+// A collapse may turn a triangle by at most about 75 degrees.
+static const float FLIP_COSINE = 0.25f;
+
+// Sum of weighted plane equations as a symmetric 4x4 matrix. Divided by the
+// summed weight, it gives the mean squared distance of a point to the planes.
+struct Quadric {
+	float a00, a11, a22, a01, a02, a12;
+	float b0, b1, b2;
+	float c;
+	float weight;
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	float cost;
+};
+
+static void quadric_add_plane(struct Quadric* q, const float* normal, float d, float weight) {
+	float a = normal[0];
+	float b = normal[1];
+	float c = normal[2];
+	q->a00 += a * a * weight;
+	q->a11 += b * b * weight;
+	q->a22 += c * c * weight;
+	q->a01 += a * b * weight;
+	q->a02 += a * c * weight;
+	q->a12 += b * c * weight;
+	q->b0 += a * d * weight;
+	q->b1 += b * d * weight;
+	q->b2 += c * d * weight;
+	q->c += d * d * weight;
+	q->weight += weight;
+}
+
+static void quadric_add(struct Quadric* q, const struct Quadric* other) {
+	q->a00 += other->a00;
+	q->a11 += other->a11;
+	q->a22 += other->a22;
+	q->a01 += other->a01;
+	q->a02 += other->a02;
+	q->a12 += other->a12;
+	q->b0 += other->b0;
+	q->b1 += other->b1;
+	q->b2 += other->b2;
+	q->c += other->c;
+	q->weight += other->weight;
+}
+
+static float quadric_error(const struct Quadric* q, const float* p) {
+	float x = p[0];
+	float y = p[1];
+	float z = p[2];
+	float error = q->a00 * x * x + q->a11 * y * y + q->a22 * z * z +
+		2.0f * (q->a01 * x * y + q->a02 * x * z + q->a12 * y * z) +
+		2.0f * (q->b0 * x + q->b1 * y + q->b2 * z) + q->c;
+	return q->weight > 0.0f ? fabsf(error) / q->weight : 0.0f;
+}
+
+static void triangle_normal(const float* p0, const float* p1, const float* p2, float* normal) {
+	float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+	float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static int compare_collapses(const void* a, const void* b) {
+	float left = ((const struct Collapse*) a)->cost;
+	float right = ((const struct Collapse*) b)->cost;
+	return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static int compare_edges(const void* a, const void* b) {
+	uint64_t left = *(const uint64_t*) a;
+	uint64_t right = *(const uint64_t*) b;
+	return left < right ? -1 : left > right ? 1 : 0;
+}
+
+// Maps every vertex to the first one at the same position.
+static void build_position_remap(uint32_t* remap, const float* positions, uint32_t vertex_count) {
+	uint32_t table_size = 1;
+	while (table_size < vertex_count * 2) {
+		table_size <<= 1;
+	}
+	uint32_t* table = heap_alloc(sizeof(uint32_t) * table_size);
+	if (!table) {
+		for (uint32_t v = 0; v < vertex_count; v++) {
+			remap[v] = v;
+		}
+		return;
+	}
+	memset(table, 0xff, sizeof(uint32_t) * table_size);
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		uint32_t bits[3];
+		memcpy(bits, positions + v * 3, sizeof(bits));
+		uint32_t hash = (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		for (uint32_t slot = hash & (table_size - 1);; slot = (slot + 1) & (table_size - 1)) {
+			if (table[slot] == UINT32_MAX) {
+				table[slot] = v;
+				remap[v] = v;
+				break;
+			}
+			if (memcmp(positions + table[slot] * 3, positions + v * 3, sizeof(float) * 3) == 0) {
+				remap[v] = table[slot];
+				break;
+			}
+		}
+	}
+	heap_free(table);
+}
+
+// Vertices on an edge used by a single triangle are locked, moving them would
+// open holes or shrink the outline.
+static void lock_border_vertices(bool* locked, const uint32_t* indices, uint32_t index_count, uint64_t* edges) {
+	for (uint32_t i = 0; i < index_count; i++) {
+		uint32_t a = indices[i];
+		uint32_t b = indices[i % 3 == 2 ? i - 2 : i + 1];
+		edges[i] = a < b ? (uint64_t) a << 32 | b : (uint64_t) b << 32 | a;
+	}
+	qsort(edges, index_count, sizeof(uint64_t), compare_edges);
+	for (uint32_t i = 0; i < index_count;) {
+		uint32_t run = 1;
+		while (i + run < index_count && edges[i + run] == edges[i]) {
+			run++;
+		}
+		if (run == 1) {
+			locked[edges[i] >> 32] = true;
+			locked[edges[i] & 0xffffffffu] = true;
+		}
+		i += run;
+	}
+}
+
+uint32_t mesh_simplify(uint32_t* destination, const uint32_t* indices, uint32_t index_count,
+	const float* positions, uint32_t vertex_count, uint32_t target_index_count, float* error) {
+	*error = 0.0f;
+	uint32_t* remap = heap_alloc(sizeof(uint32_t) * vertex_count);
+	bool* locked = heap_alloc(sizeof(bool) * vertex_count);
+	bool* touched = heap_alloc(sizeof(bool) * vertex_count);
+	struct Quadric* quadrics = heap_alloc(sizeof(struct Quadric) * vertex_count);
+	uint32_t* adjacency_offset = heap_alloc(sizeof(uint32_t) * (vertex_count + 1));
+	uint32_t* adjacency = heap_alloc(sizeof(uint32_t) * index_count);
+	struct Collapse* collapses = heap_alloc(sizeof(struct Collapse) * index_count);
+	uint64_t* edges = heap_alloc(sizeof(uint64_t) * index_count);
+	uint32_t count = 0;
+	if (!remap || !locked || !touched || !quadrics || !adjacency_offset || !adjacency || !collapses || !edges) {
+		printf("Not enough memory to simplify the mesh.\n");
+		goto done;
+	}
+
+	// topology is worked out on positions, so copies of a vertex along a
+	// normal seam move together
+	build_position_remap(remap, positions, vertex_count);
+	for (uint32_t i = 0; i < index_count; i++) {
+		destination[i] = remap[indices[i]];
+	}
+	count = index_count;
+
+	memset(locked, 0, sizeof(bool) * vertex_count);
+	lock_border_vertices(locked, destination, count, edges);
+
+	memset(quadrics, 0, sizeof(struct Quadric) * vertex_count);
+	for (uint32_t i = 0; i < count; i += 3) {
+		const float* p0 = positions + destination[i] * 3;
+		float normal[3];
+		triangle_normal(p0, positions + destination[i + 1] * 3, positions + destination[i + 2] * 3, normal);
+		float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length == 0.0f) {
+			continue;
+		}
+		normal[0] /= length;
+		normal[1] /= length;
+		normal[2] /= length;
+		float d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+		// weighted by area, large triangles should move least
+		for (uint32_t k = 0; k < 3; k++) {
+			quadric_add_plane(&quadrics[destination[i + k]], normal, d, length * 0.5f);
+		}
+	}
+
+	float max_cost = 0.0f;
+	while (count > target_index_count) {
+		// triangles of each vertex
+		memset(adjacency_offset, 0, sizeof(uint32_t) * (vertex_count + 1));
+		for (uint32_t i = 0; i < count; i++) {
+			adjacency_offset[destination[i] + 1]++;
+		}
+		for (uint32_t v = 0; v < vertex_count; v++) {
+			adjacency_offset[v + 1] += adjacency_offset[v];
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			adjacency[adjacency_offset[destination[i]]++] = i / 3;
+		}
+		for (uint32_t v = vertex_count; v > 0; v--) {
+			adjacency_offset[v] = adjacency_offset[v - 1];
+		}
+		adjacency_offset[0] = 0;
+
+		// the cheaper direction of every edge, interior edges show up twice
+		uint32_t collapse_count = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t a = destination[i];
+			uint32_t b = destination[i % 3 == 2 ? i - 2 : i + 1];
+			struct Quadric sum = quadrics[a];
+			quadric_add(&sum, &quadrics[b]);
+			float cost_ab = locked[a] ? FLT_MAX : quadric_error(&sum, positions + b * 3);
+			float cost_ba = locked[b] ? FLT_MAX : quadric_error(&sum, positions + a * 3);
+			if (cost_ab == FLT_MAX && cost_ba == FLT_MAX) {
+				continue;
+			}
+			struct Collapse* collapse = &collapses[collapse_count++];
+			collapse->from = cost_ab <= cost_ba ? a : b;
+			collapse->to = cost_ab <= cost_ba ? b : a;
+			collapse->cost = cost_ab <= cost_ba ? cost_ab : cost_ba;
+		}
+		qsort(collapses, collapse_count, sizeof(struct Collapse), compare_collapses);
+
+		// cheapest first; a vertex takes part in one collapse per pass, so the
+		// checks below see the triangles as they will be
+		uint32_t triangle_budget = (count - target_index_count + 2) / 3;
+		uint32_t removed = 0;
+		memset(touched, 0, sizeof(bool) * vertex_count);
+		for (uint32_t i = 0; i < vertex_count; i++) {
+			remap[i] = i;
+		}
+		for (uint32_t c = 0; c < collapse_count && removed < triangle_budget; c++) {
+			uint32_t from = collapses[c].from;
+			uint32_t to = collapses[c].to;
+			if (touched[from] || touched[to]) {
+				continue;
+			}
+			const uint32_t* list = adjacency + adjacency_offset[from];
+			uint32_t list_count = adjacency_offset[from + 1] - adjacency_offset[from];
+			bool flips = false;
+			for (uint32_t t = 0; t < list_count && !flips; t++) {
+				const uint32_t* corners = destination + list[t] * 3;
+				if (corners[0] == to || corners[1] == to || corners[2] == to) {
+					continue;
+				}
+				// a triangle that would turn over folds the surface onto itself
+				const float* before[3];
+				const float* after[3];
+				for (uint32_t k = 0; k < 3; k++) {
+					before[k] = positions + corners[k] * 3;
+					after[k] = corners[k] == from ? positions + to * 3 : before[k];
+				}
+				float normal_before[3];
+				float normal_after[3];
+				triangle_normal(before[0], before[1], before[2], normal_before);
+				triangle_normal(after[0], after[1], after[2], normal_after);
+				float dot = normal_before[0] * normal_after[0] + normal_before[1] * normal_after[1] +
+					normal_before[2] * normal_after[2];
+				float length_before = normal_before[0] * normal_before[0] + normal_before[1] * normal_before[1] +
+					normal_before[2] * normal_before[2];
+				float length_after = normal_after[0] * normal_after[0] + normal_after[1] * normal_after[1] +
+					normal_after[2] * normal_after[2];
+				// small turns add up over the passes, so anything steep counts as a flip
+				flips = dot <= FLIP_COSINE * sqrtf(length_before * length_after);
+			}
+			if (flips) {
+				continue;
+			}
+			remap[from] = to;
+			quadric_add(&quadrics[to], &quadrics[from]);
+			if (collapses[c].cost > max_cost) {
+				max_cost = collapses[c].cost;
+			}
+			for (uint32_t t = 0; t < list_count; t++) {
+				const uint32_t* corners = destination + list[t] * 3;
+				touched[corners[0]] = true;
+				touched[corners[1]] = true;
+				touched[corners[2]] = true;
+				if (corners[0] == to || corners[1] == to || corners[2] == to) {
+					removed++;
+				}
+			}
+		}
+		if (removed == 0) {
+			break;
+		}
+
+		uint32_t written = 0;
+		for (uint32_t i = 0; i < count; i += 3) {
+			uint32_t a = remap[destination[i]];
+			uint32_t b = remap[destination[i + 1]];
+			uint32_t c = remap[destination[i + 2]];
+			if (a != b && b != c && a != c) {
+				destination[written++] = a;
+				destination[written++] = b;
+				destination[written++] = c;
+			}
+		}
+		count = written;
+	}
+	*error = sqrtf(max_cost);
+
+done:
+	heap_free(remap);
+	heap_free(locked);
+	heap_free(touched);
+	heap_free(quadrics);
+	heap_free(adjacency_offset);
+	heap_free(adjacency);
+	heap_free(collapses);
+	heap_free(edges);
+	return count;
+}
+
+void mesh_generate_lods(struct Mesh* mesh, uint32_t max_lods) {
+	if (max_lods > MESH_MAX_LODS) {
+		max_lods = MESH_MAX_LODS;
+	}
+	// levels are simplified into their own arrays and joined behind the full mesh at the end
+	uint32_t* levels[MESH_MAX_LODS] = {};
+	uint32_t total = mesh->index_count;
+	const uint32_t* previous_indices = mesh->indices + mesh->lods[0].index_offset;
+	while (mesh->lod_count < max_lods) {
+		const struct MeshLod* previous = &mesh->lods[mesh->lod_count - 1];
+		if (previous->index_count / 3 < LOD_MIN_TRIANGLES * 2) {
+			break;
+		}
+		uint32_t* level = heap_alloc(sizeof(uint32_t) * previous->index_count);
+		if (!level) {
+			printf("Not enough memory for detail levels.\n");
+			break;
+		}
+		float error = 0.0f;
+		uint32_t count = mesh_simplify(level, previous_indices, previous->index_count,
+			mesh->positions, mesh->vertex_count, previous->index_count / 6 * 3, &error);
+		if (count == 0 || count > previous->index_count * LOD_MIN_REDUCTION) {
+			heap_free(level);
+			break;
+		}
+		// each level is simplified from the one before, so their errors add up
+		mesh->lods[mesh->lod_count] = (struct MeshLod) {
+			.index_offset = total,
+			.index_count = count,
+			.error = previous->error + error,
+		};
+		levels[mesh->lod_count] = level;
+		previous_indices = level;
+		mesh->lod_count++;
+		total += count;
+	}
+
+	uint32_t* indices = heap_alloc(sizeof(uint32_t) * total);
+	if (indices) {
+		memcpy(indices, mesh->indices, sizeof(uint32_t) * mesh->index_count);
+		for (uint32_t i = 1; i < mesh->lod_count; i++) {
+			memcpy(indices + mesh->lods[i].index_offset, levels[i], sizeof(uint32_t) * mesh->lods[i].index_count);
+		}
+		heap_free(mesh->indices);
+		mesh->indices = indices;
+		mesh->index_count = total;
+	} else {
+		printf("Not enough memory for detail levels.\n");
+		mesh->lod_count = 1;
+	}
+	for (uint32_t i = 1; i < MESH_MAX_LODS; i++) {
+		heap_free(levels[i]);
+	}
+}
@@ -0,0 +1,88 @@
+// Offline mesh converter: imports OBJ or glTF, generates simplified detail
+// levels, optimizes every level for the vertex cache and overdraw and the
+// shared vertices for fetch, then writes the quantized mesh file the renderer
+// maps with --mesh.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh.h"
+
+static const uint32_t REPORT_CACHE_SIZE = 16;
+static const uint32_t DEFAULT_LODS = 6;
+
+static void print_usage(const char* program) {
+	printf("Usage: %s [options] <input.obj|input.gltf|input.glb> <output.mesh>\n", program);
+	printf("  --no-optimize         keep the imported triangle and vertex order\n");
+	printf("  --lods <n>            detail levels to generate, including the full mesh (default %u, max %d)\n",
+		DEFAULT_LODS, MESH_MAX_LODS);
+}
+
+int main(int argc, char** argv) {
+	bool optimize = true;
+	uint32_t lods = DEFAULT_LODS;
+	const char* input = NULL;
+	const char* output = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--no-optimize") == 0) {
+			optimize = false;
+		} else if (strcmp(argv[i], "--lods") == 0 && i + 1 < argc) {
+			lods = strtoul(argv[++i], NULL, 10);
+			if (lods < 1 || lods > MESH_MAX_LODS) {
+				printf("--lods must be between 1 and %d.\n", MESH_MAX_LODS);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--help") == 0) {
+			print_usage(argv[0]);
+			return 0;
+		} else if (!input) {
+			input = argv[i];
+		} else if (!output) {
+			output = argv[i];
+		} else {
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+	if (!input || !output) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	struct Mesh mesh;
+	if (!mesh_import(input, &mesh)) {
+		return -1;
+	}
+	uint32_t triangle_count = mesh.index_count / 3;
+	printf("Imported %u vertices, %u triangles.\n", mesh.vertex_count, triangle_count);
+	printf("ACMR (%u entry FIFO): %.3f as imported\n", REPORT_CACHE_SIZE,
+		mesh_vertex_cache_acmr(mesh.indices, mesh.index_count, mesh.vertex_count, REPORT_CACHE_SIZE));
+	mesh_generate_lods(&mesh, lods);
+	for (uint32_t i = 0; i < mesh.lod_count; i++) {
+		struct MeshLod* lod = &mesh.lods[i];
+		uint32_t* indices = mesh.indices + lod->index_offset;
+		if (optimize) {
+			mesh_optimize_vertex_cache(indices, lod->index_count, mesh.vertex_count);
+			mesh_optimize_overdraw(indices, lod->index_count, mesh.positions, mesh.vertex_count);
+		}
+		printf("LOD %u: %u triangles, error %g, ACMR %.3f\n", i, lod->index_count / 3, lod->error,
+			mesh_vertex_cache_acmr(indices, lod->index_count, mesh.vertex_count, REPORT_CACHE_SIZE));
+	}
+	if (optimize) {
+		// level 0 references every vertex first, so it gets the most local fetch order
+		mesh_optimize_vertex_fetch(&mesh);
+	}
+
+	if (!mesh_write(output, &mesh)) {
+		mesh_free(&mesh);
+		return -1;
+	}
+	// float position and normal with 32-bit indices, against the packed layout
+	size_t unpacked = (size_t) mesh.vertex_count * 24 + (size_t) mesh.index_count * 4;
+	size_t packed = (size_t) mesh.vertex_count * sizeof(struct PackedVertex) +
+		(size_t) mesh.index_count * (mesh.vertex_count <= 65536 ? 2 : 4);
+	printf("Wrote %s: %u vertices, %zu bytes of geometry (%.0f%% of unquantized).\n",
+		output, mesh.vertex_count, packed, unpacked ? 100.0 * packed / unpacked : 0.0);
+	mesh_free(&mesh);
+	return 0;
+}
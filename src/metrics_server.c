@@ -0,0 +1,173 @@
+#include "metrics_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+// How long the worker sleeps without a connection before it checks for new text.
+static const int METRICS_POLL_MS = 250;
+
+static bool open_socket(struct MetricsServer* server) {
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(server->socket_path) >= sizeof(address.sun_path)) {
+		printf("Metrics socket path too long: %s\n", server->socket_path);
+		return false;
+	}
+	strcpy(address.sun_path, server->socket_path);
+	// a socket left behind by a previous run that did not shut down is replaced,
+	// anything else at the path is kept
+	struct stat info;
+	if (lstat(server->socket_path, &info) == 0) {
+		if (!S_ISSOCK(info.st_mode)) {
+			printf("%s exists and is not a socket, the metrics socket is not created.\n", server->socket_path);
+			return false;
+		}
+		unlink(server->socket_path);
+	}
+	server->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (server->socket_fd < 0) {
+		printf("Failed to create the metrics socket. Error: %s\n", strerror(errno));
+		return false;
+	}
+	if (bind(server->socket_fd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+		listen(server->socket_fd, 4) != 0) {
+		printf("Failed to listen on %s. Error: %s\n", server->socket_path, strerror(errno));
+		close(server->socket_fd);
+		server->socket_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+// Copies the newest text to the worker's side. Returns its version.
+static uint64_t take_text(struct MetricsServer* server) {
+	pthread_mutex_lock(&server->lock);
+	uint64_t version = server->version;
+	memcpy(server->serving, server->text, server->length);
+	server->serving_length = server->length;
+	pthread_mutex_unlock(&server->lock);
+	return version;
+}
+
+static void serve_connection(struct MetricsServer* server) {
+	int client = accept(server->socket_fd, NULL, NULL);
+	if (client < 0) {
+		return;
+	}
+	size_t sent = 0;
+	while (sent < server->serving_length) {
+		// MSG_NOSIGNAL: a reader hanging up early must not kill the process with SIGPIPE
+		ssize_t written = send(client, server->serving + sent, server->serving_length - sent, MSG_NOSIGNAL);
+		if (written <= 0) {
+			break;
+		}
+		sent += (size_t) written;
+	}
+	close(client);
+}
+
+static void write_file(struct MetricsServer* server) {
+	FILE* fp = fopen(server->temp_path, "wb");
+	if (fp == NULL) {
+		printf("Failed to write %s\n", server->temp_path);
+		return;
+	}
+	bool written = fwrite(server->serving, 1, server->serving_length, fp) == server->serving_length;
+	written &= fclose(fp) == 0;
+	if (!written || rename(server->temp_path, server->file_path) != 0) {
+		printf("Failed to write %s\n", server->file_path);
+	}
+}
+
+static void* metrics_server_main(void* arg) {
+	struct MetricsServer* server = arg;
+	while (atomic_load(&server->running)) {
+		struct pollfd listener = {
+			.fd = server->socket_fd,
+			.events = POLLIN,
+		};
+		// a negative fd is ignored by poll, which then only waits out the timeout
+		int ready = poll(&listener, 1, METRICS_POLL_MS);
+		uint64_t version = take_text(server);
+		if (ready > 0 && (listener.revents & POLLIN)) {
+			serve_connection(server);
+		}
+		if (server->file_path && version != server->written_version) {
+			write_file(server);
+			server->written_version = version;
+		}
+	}
+	return NULL;
+}
+
+bool metrics_server_start(struct MetricsServer* server, const char* socket_path, const char* file_path) {
+	server->socket_path = socket_path;
+	server->socket_fd = -1;
+	server->file_path = file_path;
+	server->temp_path = NULL;
+	server->length = 0;
+	server->version = 0;
+	server->written_version = 0;
+	if (socket_path && !open_socket(server)) {
+		server->socket_path = NULL;
+	}
+	if (file_path) {
+		size_t length = strlen(file_path);
+		server->temp_path = heap_alloc(length + sizeof(".tmp"));
+		memcpy(server->temp_path, file_path, length);
+		memcpy(server->temp_path + length, ".tmp", sizeof(".tmp"));
+	}
+	if (!server->socket_path && !server->file_path) {
+		return false;
+	}
+	pthread_mutex_init(&server->lock, NULL);
+	atomic_init(&server->running, true);
+	server->started = pthread_create(&server->thread, NULL, metrics_server_main, server) == 0;
+	if (!server->started) {
+		printf("Failed to start the metrics thread.\n");
+		metrics_server_stop(server);
+	}
+	return server->started;
+}
+
+void metrics_server_publish(struct MetricsServer* server, const char* text, size_t length) {
+	if (!server->started) {
+		return;
+	}
+	if (length > METRICS_TEXT_SIZE) {
+		length = METRICS_TEXT_SIZE;
+	}
+	pthread_mutex_lock(&server->lock);
+	memcpy(server->text, text, length);
+	server->length = length;
+	server->version++;
+	pthread_mutex_unlock(&server->lock);
+}
+
+void metrics_server_stop(struct MetricsServer* server) {
+	if (server->started) {
+		atomic_store(&server->running, false);
+		pthread_join(server->thread, NULL);
+		server->started = false;
+		// the last text published may not have been written yet
+		if (server->file_path && take_text(server) != server->written_version) {
+			write_file(server);
+		}
+		pthread_mutex_destroy(&server->lock);
+	}
+	if (server->socket_fd >= 0) {
+		close(server->socket_fd);
+		unlink(server->socket_path);
+		server->socket_fd = -1;
+	}
+	heap_free(server->temp_path);
+	server->temp_path = NULL;
+}
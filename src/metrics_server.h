@@ -0,0 +1,42 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_TEXT_SIZE 4096
+
+// Serves the newest metrics text from its own thread, so a slow reader or
+// disk never holds up the render loop. Each connection to the Unix socket
+// gets the text and is closed; the text file is rewritten whenever the text
+// changes and replaced by rename, so a reader never sees it half written.
+struct MetricsServer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	atomic_bool running;
+	bool started;
+	const char* socket_path;
+	int socket_fd;
+	const char* file_path;
+	char* temp_path;
+	// guarded by lock, version counts publishes
+	char text[METRICS_TEXT_SIZE];
+	size_t length;
+	uint64_t version;
+	// the worker's own copy, so no I/O happens under the lock
+	char serving[METRICS_TEXT_SIZE];
+	size_t serving_length;
+	uint64_t written_version;
+};
+
+// Either path may be NULL. Returns false when neither endpoint could be set up.
+bool metrics_server_start(struct MetricsServer* server, const char* socket_path, const char* file_path);
+// Never blocks on I/O, only on the worker copying out the previous text.
+void metrics_server_publish(struct MetricsServer* server, const char* text, size_t length);
+// Joins the thread and removes the socket. The text file stays.
+void metrics_server_stop(struct MetricsServer* server);
+
+#endif
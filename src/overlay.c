@@ -0,0 +1,163 @@
+#include "overlay.h"
+
+// Classic 5x7 font for ' ' to '_', one byte per column, bit 0 the top row.
+static const uint8_t FONT[64][5] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+	{0x00, 0x00, 0x5f, 0x00, 0x00}, // !
+	{0x00, 0x07, 0x00, 0x07, 0x00}, // "
+	{0x14, 0x7f, 0x14, 0x7f, 0x14}, // #
+	{0x24, 0x2a, 0x7f, 0x2a, 0x12}, // $
+	{0x23, 0x13, 0x08, 0x64, 0x62}, // %
+	{0x36, 0x49, 0x55, 0x22, 0x50}, // &
+	{0x00, 0x05, 0x03, 0x00, 0x00}, // '
+	{0x00, 0x1c, 0x22, 0x41, 0x00}, // (
+	{0x00, 0x41, 0x22, 0x1c, 0x00}, // )
+	{0x14, 0x08, 0x3e, 0x08, 0x14}, // *
+	{0x08, 0x08, 0x3e, 0x08, 0x08}, // +
+	{0x00, 0x50, 0x30, 0x00, 0x00}, // ,
+	{0x08, 0x08, 0x08, 0x08, 0x08}, // -
+	{0x00, 0x60, 0x60, 0x00, 0x00}, // .
+	{0x20, 0x10, 0x08, 0x04, 0x02}, // /
+	{0x3e, 0x51, 0x49, 0x45, 0x3e}, // 0
+	{0x00, 0x42, 0x7f, 0x40, 0x00}, // 1
+	{0x42, 0x61, 0x51, 0x49, 0x46}, // 2
+	{0x21, 0x41, 0x45, 0x4b, 0x31}, // 3
+	{0x18, 0x14, 0x12, 0x7f, 0x10}, // 4
+	{0x27, 0x45, 0x45, 0x45, 0x39}, // 5
+	{0x3c, 0x4a, 0x49, 0x49, 0x30}, // 6
+	{0x01, 0x71, 0x09, 0x05, 0x03}, // 7
+	{0x36, 0x49, 0x49, 0x49, 0x36}, // 8
+	{0x06, 0x49, 0x49, 0x29, 0x1e}, // 9
+	{0x00, 0x36, 0x36, 0x00, 0x00}, // :
+	{0x00, 0x56, 0x36, 0x00, 0x00}, // ;
+	{0x08, 0x14, 0x22, 0x41, 0x00}, // <
+	{0x14, 0x14, 0x14, 0x14, 0x14}, // =
+	{0x00, 0x41, 0x22, 0x14, 0x08}, // >
+	{0x02, 0x01, 0x51, 0x09, 0x06}, // ?
+	{0x32, 0x49, 0x79, 0x41, 0x3e}, // @
+	{0x7e, 0x11, 0x11, 0x11, 0x7e}, // A
+	{0x7f, 0x49, 0x49, 0x49, 0x36}, // B
+	{0x3e, 0x41, 0x41, 0x41, 0x22}, // C
+	{0x7f, 0x41, 0x41, 0x22, 0x1c}, // D
+	{0x7f, 0x49, 0x49, 0x49, 0x41}, // E
+	{0x7f, 0x09, 0x09, 0x09, 0x01}, // F
+	{0x3e, 0x41, 0x49, 0x49, 0x7a}, // G
+	{0x7f, 0x08, 0x08, 0x08, 0x7f}, // H
+	{0x00, 0x41, 0x7f, 0x41, 0x00}, // I
+	{0x20, 0x40, 0x41, 0x3f, 0x01}, // J
+	{0x7f, 0x08, 0x14, 0x22, 0x41}, // K
+	{0x7f, 0x40, 0x40, 0x40, 0x40}, // L
+	{0x7f, 0x02, 0x0c, 0x02, 0x7f}, // M
+	{0x7f, 0x04, 0x08, 0x10, 0x7f}, // N
+	{0x3e, 0x41, 0x41, 0x41, 0x3e}, // O
+	{0x7f, 0x09, 0x09, 0x09, 0x06}, // P
+	{0x3e, 0x41, 0x51, 0x21, 0x5e}, // Q
+	{0x7f, 0x09, 0x19, 0x29, 0x46}, // R
+	{0x46, 0x49, 0x49, 0x49, 0x31}, // S
+	{0x01, 0x01, 0x7f, 0x01, 0x01}, // T
+	{0x3f, 0x40, 0x40, 0x40, 0x3f}, // U
+	{0x1f, 0x20, 0x40, 0x20, 0x1f}, // V
+	{0x3f, 0x40, 0x38, 0x40, 0x3f}, // W
+	{0x63, 0x14, 0x08, 0x14, 0x63}, // X
+	{0x07, 0x08, 0x70, 0x08, 0x07}, // Y
+	{0x61, 0x51, 0x49, 0x45, 0x43}, // Z
+	{0x00, 0x7f, 0x41, 0x41, 0x00}, // [
+	{0x02, 0x04, 0x08, 0x10, 0x20}, // backslash
+	{0x00, 0x41, 0x41, 0x7f, 0x00}, // ]
+	{0x04, 0x02, 0x01, 0x02, 0x04}, // ^
+	{0x40, 0x40, 0x40, 0x40, 0x40}, // _
+};
+
+void overlay_begin(struct OverlayBuilder* builder, struct OverlayVertex* vertices, uint32_t capacity) {
+	builder->vertices = vertices;
+	builder->capacity = capacity;
+	builder->count = 0;
+}
+
+static uint16_t clamp_coordinate(int32_t value) {
+	return value < 0 ? 0 : value > UINT16_MAX ? UINT16_MAX : (uint16_t) value;
+}
+
+void overlay_rect(struct OverlayBuilder* builder, int32_t x, int32_t y, int32_t width, int32_t height,
+	const uint8_t color[4]) {
+	if (width <= 0 || height <= 0 || builder->count + 6 > builder->capacity) {
+		return;
+	}
+	uint16_t left = clamp_coordinate(x);
+	uint16_t top = clamp_coordinate(y);
+	uint16_t right = clamp_coordinate(x + width);
+	uint16_t bottom = clamp_coordinate(y + height);
+	uint16_t corners[6][2] = {
+		{left, top}, {right, top}, {left, bottom},
+		{left, bottom}, {right, top}, {right, bottom},
+	};
+	for (uint32_t i = 0; i < 6; i++) {
+		struct OverlayVertex* vertex = &builder->vertices[builder->count++];
+		vertex->x = corners[i][0];
+		vertex->y = corners[i][1];
+		for (uint32_t c = 0; c < 4; c++) {
+			vertex->color[c] = color[c];
+		}
+	}
+}
+
+static const uint8_t* glyph(char c) {
+	if (c >= 'a' && c <= 'z') {
+		c -= 'a' - 'A';
+	}
+	if (c < ' ' || c > '_') {
+		c = ' ';
+	}
+	return FONT[c - ' '];
+}
+
+void overlay_text(struct OverlayBuilder* builder, int32_t x, int32_t y, const char* text, const uint8_t color[4]) {
+	int32_t pen_x = x;
+	for (; *text; text++) {
+		if (*text == '\n') {
+			pen_x = x;
+			y += OVERLAY_LINE_HEIGHT;
+			continue;
+		}
+		const uint8_t* columns = glyph(*text);
+		for (int32_t column = 0; column < 5; column++) {
+			// one rectangle per vertical run of set pixels
+			uint32_t bits = columns[column];
+			int32_t row = 0;
+			while (bits) {
+				while (!(bits & 1)) {
+					bits >>= 1;
+					row++;
+				}
+				int32_t start = row;
+				while (bits & 1) {
+					bits >>= 1;
+					row++;
+				}
+				overlay_rect(builder, pen_x + column * OVERLAY_SCALE, y + start * OVERLAY_SCALE, OVERLAY_SCALE,
+					(row - start) * OVERLAY_SCALE, color);
+			}
+		}
+		pen_x += OVERLAY_CHAR_WIDTH;
+	}
+}
+
+void overlay_text_extent(const char* text, int32_t* width, int32_t* height) {
+	int32_t columns = 0;
+	int32_t line = 0;
+	int32_t lines = *text ? 1 : 0;
+	for (; *text; text++) {
+		if (*text == '\n') {
+			line = 0;
+			// a trailing newline starts no new line
+			lines += text[1] != '\0';
+			continue;
+		}
+		line++;
+		if (line > columns) {
+			columns = line;
+		}
+	}
+	*width = columns * OVERLAY_CHAR_WIDTH;
+	*height = lines * OVERLAY_LINE_HEIGHT;
+}
@@ -0,0 +1,37 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdint.h>
+
+// Glyphs are 5x7 font pixels in a 6x8 cell, each font pixel OVERLAY_SCALE
+// screen pixels wide.
+#define OVERLAY_SCALE 2
+#define OVERLAY_CHAR_WIDTH (6 * OVERLAY_SCALE)
+#define OVERLAY_LINE_HEIGHT (9 * OVERLAY_SCALE)
+
+// Vertex of shaders/overlay.vert: position in pixels from the top left
+// corner, colour as unorm8.
+struct OverlayVertex {
+	uint16_t x;
+	uint16_t y;
+	uint8_t color[4];
+};
+
+// Triangles built on the CPU, two per rectangle. Primitives that no longer
+// fit are dropped, so the list never outgrows its storage.
+struct OverlayBuilder {
+	struct OverlayVertex* vertices;
+	uint32_t capacity;
+	uint32_t count;
+};
+
+void overlay_begin(struct OverlayBuilder* builder, struct OverlayVertex* vertices, uint32_t capacity);
+void overlay_rect(struct OverlayBuilder* builder, int32_t x, int32_t y, int32_t width, int32_t height,
+	const uint8_t color[4]);
+// Draws text with its top left corner at x, y, one line per '\n'. Lower case
+// is drawn as upper case, characters without a glyph as blanks.
+void overlay_text(struct OverlayBuilder* builder, int32_t x, int32_t y, const char* text, const uint8_t color[4]);
+// Size in pixels of the block overlay_text() draws for text.
+void overlay_text_extent(const char* text, int32_t* width, int32_t* height);
+
+#endif
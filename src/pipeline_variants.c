@@ -0,0 +1,94 @@
+#include "pipeline_variants.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Indexed by feature bit, which is also the constant_id in the shaders.
+static const char* FEATURE_NAMES[SHADER_FEATURE_COUNT] = {
+	"lighting",
+	"lod-tint",
+	"normal-color",
+};
+
+void shader_specialization_init(struct ShaderSpecialization* specialization, uint32_t features) {
+	for (uint32_t i = 0; i < SHADER_FEATURE_COUNT; i++) {
+		specialization->entries[i] = (VkSpecializationMapEntry) {
+			.constantID = i,
+			.offset = i * sizeof(VkBool32),
+			.size = sizeof(VkBool32),
+		};
+		specialization->values[i] = (features >> i) & 1u ? VK_TRUE : VK_FALSE;
+	}
+	specialization->info = (VkSpecializationInfo) {
+		.mapEntryCount = SHADER_FEATURE_COUNT,
+		.pMapEntries = specialization->entries,
+		.dataSize = sizeof(specialization->values),
+		.pData = specialization->values,
+	};
+}
+
+VkPipeline pipeline_variants_find(const struct PipelineVariants* variants, const struct PipelineKey* key) {
+	for (uint32_t i = 0; i < variants->count; i++) {
+		const struct PipelineKey* other = &variants->variants[i].key;
+		if (other->features == key->features && other->samples == key->samples) {
+			return variants->variants[i].pipeline;
+		}
+	}
+	return VK_NULL_HANDLE;
+}
+
+bool pipeline_variants_add(struct PipelineVariants* variants, const struct PipelineKey* key, VkPipeline pipeline) {
+	if (variants->count == PIPELINE_VARIANT_CAPACITY) {
+		return false;
+	}
+	variants->variants[variants->count++] = (struct PipelineVariant) {
+		.key = *key,
+		.pipeline = pipeline,
+	};
+	return true;
+}
+
+void pipeline_variants_destroy(struct PipelineVariants* variants, VkDevice device) {
+	for (uint32_t i = 0; i < variants->count; i++) {
+		vkDestroyPipeline(device, variants->variants[i].pipeline, NULL);
+	}
+	variants->count = 0;
+}
+
+bool parse_shader_features(const char* text, uint32_t* features) {
+	*features = 0;
+	if (strcmp(text, "none") == 0) {
+		return true;
+	}
+	while (*text) {
+		size_t length = strcspn(text, ",");
+		uint32_t i = 0;
+		while (i < SHADER_FEATURE_COUNT &&
+			(strlen(FEATURE_NAMES[i]) != length || strncmp(text, FEATURE_NAMES[i], length) != 0)) {
+			i++;
+		}
+		if (i == SHADER_FEATURE_COUNT) {
+			printf("Unknown shader feature: %.*s\n", (int) length, text);
+			return false;
+		}
+		*features |= 1u << i;
+		text += length;
+		if (*text == ',') {
+			text++;
+		}
+	}
+	return true;
+}
+
+void format_shader_features(uint32_t features, char* out, size_t size) {
+	size_t used = 0;
+	out[0] = '\0';
+	for (uint32_t i = 0; i < SHADER_FEATURE_COUNT && used < size; i++) {
+		if (features & (1u << i)) {
+			used += snprintf(out + used, size - used, "%s%s", used ? "," : "", FEATURE_NAMES[i]);
+		}
+	}
+	if (used == 0) {
+		snprintf(out, size, "none");
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef PIPELINE_VARIANTS_H
+#define PIPELINE_VARIANTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vulkan/vulkan_core.h>
+
+// Feature toggles of the mesh shader. Bit i is the boolean specialization
+// constant with constant_id i, so the driver folds a disabled feature away
+// when it compiles the variant and the shader carries no branch for it.
+enum ShaderFeature {
+	SHADER_FEATURE_LIGHTING = 1u << 0,
+	SHADER_FEATURE_LOD_TINT = 1u << 1,
+	SHADER_FEATURE_NORMAL_COLOR = 1u << 2,
+};
+#define SHADER_FEATURE_COUNT 3
+#define SHADER_FEATURE_DEFAULTS SHADER_FEATURE_LIGHTING
+// The sample count is fixed for a run, so every feature set fits.
+#define PIPELINE_VARIANT_CAPACITY (1u << SHADER_FEATURE_COUNT)
+
+// What a pipeline is built from besides the state all variants share. Equal
+// keys always produce the same pipeline.
+struct PipelineKey {
+	uint32_t features;
+	VkSampleCountFlagBits samples;
+};
+
+// Specialization constants of one feature set, kept in one place so the
+// pointers in info stay valid while the pipeline is created.
+struct ShaderSpecialization {
+	VkSpecializationMapEntry entries[SHADER_FEATURE_COUNT];
+	VkBool32 values[SHADER_FEATURE_COUNT];
+	VkSpecializationInfo info;
+};
+
+struct PipelineVariant {
+	struct PipelineKey key;
+	VkPipeline pipeline;
+};
+
+// Pipelines built so far, looked up by key. Variants are only destroyed at
+// exit, since a command buffer in flight may still use any of them.
+struct PipelineVariants {
+	struct PipelineVariant variants[PIPELINE_VARIANT_CAPACITY];
+	uint32_t count;
+};
+
+void shader_specialization_init(struct ShaderSpecialization* specialization, uint32_t features);
+// VK_NULL_HANDLE when no variant was built for key yet.
+VkPipeline pipeline_variants_find(const struct PipelineVariants* variants, const struct PipelineKey* key);
+// Returns false when the cache is full, the pipeline then stays with the caller.
+bool pipeline_variants_add(struct PipelineVariants* variants, const struct PipelineKey* key, VkPipeline pipeline);
+void pipeline_variants_destroy(struct PipelineVariants* variants, VkDevice device);
+// Comma separated feature names, e.g. "lighting,lod-tint", or "none".
+bool parse_shader_features(const char* text, uint32_t* features);
+// The same form parse_shader_features() reads.
+void format_shader_features(uint32_t features, char* out, size_t size);
+
+#endif
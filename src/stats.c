@@ -0,0 +1,176 @@
+#include "stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const double MEGABYTE = 1024.0 * 1024.0;
+
+void frame_history_push(struct FrameHistory* history, float milliseconds) {
+	history->samples[history->next] = milliseconds;
+	history->next = (history->next + 1) % STATS_HISTORY_SIZE;
+	if (history->count < STATS_HISTORY_SIZE) {
+		history->count++;
+	}
+}
+
+float frame_history_get(const struct FrameHistory* history, uint32_t index) {
+	uint32_t oldest = (history->next + STATS_HISTORY_SIZE - history->count) % STATS_HISTORY_SIZE;
+	return history->samples[(oldest + index) % STATS_HISTORY_SIZE];
+}
+
+static int compare_floats(const void* a, const void* b) {
+	float x = *(const float*) a;
+	float y = *(const float*) b;
+	return (x > y) - (x < y);
+}
+
+struct FrameTimeSummary frame_history_summary(const struct FrameHistory* history) {
+	struct FrameTimeSummary summary = {};
+	if (history->count == 0) {
+		return summary;
+	}
+	// sorted on the stack, the history is small and this runs a few times per second
+	float sorted[STATS_HISTORY_SIZE];
+	double total = 0.0;
+	for (uint32_t i = 0; i < history->count; i++) {
+		sorted[i] = frame_history_get(history, i);
+		total += sorted[i];
+	}
+	qsort(sorted, history->count, sizeof(float), compare_floats);
+	summary.average = (float) (total / history->count);
+	summary.min = sorted[0];
+	summary.max = sorted[history->count - 1];
+	summary.p99 = sorted[(history->count - 1) * 99 / 100];
+	return summary;
+}
+
+void memory_tracker_init(struct MemoryTracker* tracker, const VkPhysicalDeviceMemoryProperties* properties) {
+	*tracker = (struct MemoryTracker) {
+		.heap_count = properties->memoryHeapCount,
+	};
+	for (uint32_t i = 0; i < properties->memoryTypeCount; i++) {
+		tracker->type_heaps[i] = properties->memoryTypes[i].heapIndex;
+	}
+	for (uint32_t i = 0; i < properties->memoryHeapCount; i++) {
+		tracker->heap_sizes[i] = properties->memoryHeaps[i].size;
+		tracker->heap_device_local[i] = (properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+	}
+}
+
+void memory_tracker_add(struct MemoryTracker* tracker, VkDeviceMemory memory, uint32_t type, VkDeviceSize size) {
+	if (tracker->count == MEMORY_TRACKER_CAPACITY) {
+		printf("Memory tracker full, an allocation of %lu bytes is not reported.\n", (unsigned long) size);
+		return;
+	}
+	uint32_t heap = tracker->type_heaps[type];
+	tracker->allocations[tracker->count].memory = memory;
+	tracker->allocations[tracker->count].heap = heap;
+	tracker->allocations[tracker->count].size = size;
+	tracker->count++;
+	tracker->heap_used[heap] += size;
+}
+
+void memory_tracker_remove(struct MemoryTracker* tracker, VkDeviceMemory memory) {
+	for (uint32_t i = 0; i < tracker->count; i++) {
+		if (tracker->allocations[i].memory == memory) {
+			tracker->heap_used[tracker->allocations[i].heap] -= tracker->allocations[i].size;
+			tracker->allocations[i] = tracker->allocations[--tracker->count];
+			return;
+		}
+	}
+}
+
+const char* present_mode_name(VkPresentModeKHR mode) {
+	switch (mode) {
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+		default: return "other";
+	}
+}
+
+// snprintf at out + used that never moves used past size - 1, so calls can be chained.
+static size_t append(char* out, size_t size, size_t used, const char* format, ...) {
+	if (used + 1 >= size) {
+		return used;
+	}
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(out + used, size - used, format, args);
+	va_end(args);
+	if (written < 0) {
+		return used;
+	}
+	return used + (size_t) written < size ? used + (size_t) written : size - 1;
+}
+
+size_t format_metrics(const struct StatsSnapshot* snapshot, char* out, size_t size) {
+	size_t used = 0;
+	out[0] = '\0';
+	used = append(out, size, used, "uptime_seconds %.3f\n", snapshot->uptime);
+	used = append(out, size, used, "frames_total %lu\n", (unsigned long) snapshot->frames);
+	used = append(out, size, used, "frame_time_ms{stat=\"average\"} %.3f\n", snapshot->frame_time.average);
+	used = append(out, size, used, "frame_time_ms{stat=\"min\"} %.3f\n", snapshot->frame_time.min);
+	used = append(out, size, used, "frame_time_ms{stat=\"max\"} %.3f\n", snapshot->frame_time.max);
+	used = append(out, size, used, "frame_time_ms{stat=\"p99\"} %.3f\n", snapshot->frame_time.p99);
+	used = append(out, size, used, "cpu_frame_ms %.3f\n", snapshot->cpu_ms);
+	used = append(out, size, used, "draws_per_frame %u\n", snapshot->draws);
+	used = append(out, size, used, "triangles_per_frame %lu\n", (unsigned long) snapshot->triangles);
+	if (snapshot->has_pipeline_statistics) {
+		const struct PipelineStatistics* pipeline = &snapshot->pipeline;
+		used = append(out, size, used, "vertex_shader_invocations %lu\n", (unsigned long) pipeline->vertex_invocations);
+		used = append(out, size, used, "clipping_invocations %lu\n", (unsigned long) pipeline->clipping_invocations);
+		used = append(out, size, used, "clipping_primitives %lu\n", (unsigned long) pipeline->clipping_primitives);
+		used = append(out, size, used, "fragment_shader_invocations %lu\n",
+			(unsigned long) pipeline->fragment_invocations);
+	}
+	for (uint32_t i = 0; i < snapshot->heap_count; i++) {
+		used = append(out, size, used, "memory_heap_used_bytes{heap=\"%u\",device_local=\"%d\"} %lu\n", i,
+			snapshot->heap_device_local[i], (unsigned long) snapshot->heap_used[i]);
+		used = append(out, size, used, "memory_heap_size_bytes{heap=\"%u\",device_local=\"%d\"} %lu\n", i,
+			snapshot->heap_device_local[i], (unsigned long) snapshot->heap_sizes[i]);
+	}
+	used = append(out, size, used, "swapchain_images %u\n", snapshot->image_count);
+	used = append(out, size, used, "swapchain_width %u\n", snapshot->width);
+	used = append(out, size, used, "swapchain_height %u\n", snapshot->height);
+	if (!snapshot->headless) {
+		used = append(out, size, used, "present_mode{mode=\"%s\"} 1\n", present_mode_name(snapshot->present_mode));
+		used = append(out, size, used, "presents_total %lu\n", (unsigned long) snapshot->presents);
+		used = append(out, size, used, "present_errors_total %lu\n", (unsigned long) snapshot->present_errors);
+		used = append(out, size, used, "acquire_wait_ms %.3f\n", snapshot->acquire_ms);
+		used = append(out, size, used, "present_call_ms %.3f\n", snapshot->present_ms);
+	}
+	return used;
+}
+
+size_t format_overlay_text(const struct StatsSnapshot* snapshot, char* out, size_t size) {
+	const struct FrameTimeSummary* frame_time = &snapshot->frame_time;
+	size_t used = 0;
+	out[0] = '\0';
+	used = append(out, size, used, "FRAME %.2f MS (%.0f FPS)  MIN %.2f  MAX %.2f  P99 %.2f\n", frame_time->average,
+		frame_time->average > 0.0f ? 1000.0f / frame_time->average : 0.0f, frame_time->min, frame_time->max,
+		frame_time->p99);
+	used = append(out, size, used, "CPU %.3f MS  DRAWS %u  TRIANGLES %lu\n", snapshot->cpu_ms, snapshot->draws,
+		(unsigned long) snapshot->triangles);
+	if (snapshot->has_pipeline_statistics) {
+		const struct PipelineStatistics* pipeline = &snapshot->pipeline;
+		used = append(out, size, used, "VS %lu  FS %lu  CLIP %lu IN %lu OUT\n", (unsigned long) pipeline->vertex_invocations,
+			(unsigned long) pipeline->fragment_invocations, (unsigned long) pipeline->clipping_invocations,
+			(unsigned long) pipeline->clipping_primitives);
+	}
+	for (uint32_t i = 0; i < snapshot->heap_count; i++) {
+		used = append(out, size, used, "HEAP %u %s %.1f / %.0f MB\n", i, snapshot->heap_device_local[i] ? "DEVICE" : "HOST",
+			snapshot->heap_used[i] / MEGABYTE, snapshot->heap_sizes[i] / MEGABYTE);
+	}
+	if (snapshot->headless) {
+		used = append(out, size, used, "OFFSCREEN %u IMAGES %ux%u\n", snapshot->image_count, snapshot->width,
+			snapshot->height);
+	} else {
+		used = append(out, size, used, "SWAPCHAIN %u IMAGES %ux%u %s  ACQUIRE %.2f MS  PRESENT %.2f MS  ERRORS %lu\n",
+			snapshot->image_count, snapshot->width, snapshot->height, present_mode_name(snapshot->present_mode),
+			snapshot->acquire_ms, snapshot->present_ms, (unsigned long) snapshot->present_errors);
+	}
+	return used;
+}
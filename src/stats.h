@@ -0,0 +1,101 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vulkan/vulkan_core.h>
+
+#define STATS_HISTORY_SIZE 240
+#define MEMORY_TRACKER_CAPACITY 64
+
+// Frame times of the last STATS_HISTORY_SIZE frames, in milliseconds.
+struct FrameHistory {
+	float samples[STATS_HISTORY_SIZE];
+	uint32_t next;
+	uint32_t count;
+};
+
+struct FrameTimeSummary {
+	float average;
+	float min;
+	float max;
+	// 99th percentile, the frame time only the worst 1% of frames exceed
+	float p99;
+};
+
+// Device memory the renderer allocated, per heap. Allocations are few and
+// long lived, so a flat list is enough to find the heap of one being freed.
+struct MemoryTracker {
+	struct {
+		VkDeviceMemory memory;
+		uint32_t heap;
+		VkDeviceSize size;
+	} allocations[MEMORY_TRACKER_CAPACITY];
+	uint32_t count;
+	uint32_t type_heaps[VK_MAX_MEMORY_TYPES];
+	uint32_t heap_count;
+	VkDeviceSize heap_sizes[VK_MAX_MEMORY_HEAPS];
+	bool heap_device_local[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heap_used[VK_MAX_MEMORY_HEAPS];
+};
+
+// Results of a VK_QUERY_TYPE_PIPELINE_STATISTICS query with the statistics
+// below, in the order the device writes them.
+#define PIPELINE_STATISTICS_FLAGS (VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | \
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | \
+	VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+struct PipelineStatistics {
+	uint64_t vertex_invocations;
+	uint64_t clipping_invocations;
+	uint64_t clipping_primitives;
+	uint64_t fragment_invocations;
+};
+
+// Everything the overlay and the metrics endpoint report, taken by the render
+// thread a few times per second.
+struct StatsSnapshot {
+	double uptime;
+	uint64_t frames;
+	struct FrameTimeSummary frame_time;
+	// averages since the previous snapshot, in milliseconds
+	double cpu_ms;
+	double acquire_ms;
+	double present_ms;
+	uint32_t draws;
+	uint64_t triangles;
+	// of the newest frame the GPU has finished, when the device supports the query
+	bool has_pipeline_statistics;
+	struct PipelineStatistics pipeline;
+	uint32_t heap_count;
+	VkDeviceSize heap_used[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heap_sizes[VK_MAX_MEMORY_HEAPS];
+	bool heap_device_local[VK_MAX_MEMORY_HEAPS];
+	bool headless;
+	VkPresentModeKHR present_mode;
+	uint32_t image_count;
+	uint32_t width;
+	uint32_t height;
+	uint64_t presents;
+	// presents that returned anything but VK_SUCCESS
+	uint64_t present_errors;
+};
+
+void frame_history_push(struct FrameHistory* history, float milliseconds);
+// Oldest first, index < history->count.
+float frame_history_get(const struct FrameHistory* history, uint32_t index);
+struct FrameTimeSummary frame_history_summary(const struct FrameHistory* history);
+
+void memory_tracker_init(struct MemoryTracker* tracker, const VkPhysicalDeviceMemoryProperties* properties);
+void memory_tracker_add(struct MemoryTracker* tracker, VkDeviceMemory memory, uint32_t type, VkDeviceSize size);
+// Ignores memory that was never added, including VK_NULL_HANDLE.
+void memory_tracker_remove(struct MemoryTracker* tracker, VkDeviceMemory memory);
+
+const char* present_mode_name(VkPresentModeKHR mode);
+// One "name value" line per metric, in the Prometheus text format. Returns
+// the length written, truncated to size - 1.
+size_t format_metrics(const struct StatsSnapshot* snapshot, char* out, size_t size);
+// A few short lines for the on-screen overlay.
+size_t format_overlay_text(const struct StatsSnapshot* snapshot, char* out, size_t size);
+
+#endif
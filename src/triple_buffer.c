@@ -0,0 +1,36 @@
+#include "triple_buffer.h"
+
+#define TRIPLE_BUFFER_FRESH 4u
+#define TRIPLE_BUFFER_INDEX 3u
+
+void triple_buffer_init(struct TripleBuffer* buffer) {
+	buffer->back = 0;
+	atomic_init(&buffer->shared, 1);
+	buffer->front = 2;
+}
+
+uint32_t triple_buffer_write_index(struct TripleBuffer* buffer) {
+	return buffer->back;
+}
+
+void triple_buffer_publish(struct TripleBuffer* buffer) {
+	// release makes the slot contents visible before the consumer can take it, acquire
+	// makes sure the consumer is done reading the slot handed back
+	unsigned previous = atomic_exchange_explicit(&buffer->shared, buffer->back | TRIPLE_BUFFER_FRESH,
+		memory_order_acq_rel);
+	buffer->back = previous & TRIPLE_BUFFER_INDEX;
+}
+
+bool triple_buffer_acquire(struct TripleBuffer* buffer) {
+	if ((atomic_load_explicit(&buffer->shared, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) == 0) {
+		return false;
+	}
+	// only the producer sets the fresh bit, so it is still set here
+	unsigned previous = atomic_exchange_explicit(&buffer->shared, buffer->front, memory_order_acq_rel);
+	buffer->front = previous & TRIPLE_BUFFER_INDEX;
+	return true;
+}
+
+uint32_t triple_buffer_read_index(struct TripleBuffer* buffer) {
+	return buffer->front;
+}
@@ -0,0 +1,35 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRIPLE_BUFFER_SLOTS 3
+
+// Lock-free hand-off of the newest value from one producer thread to one
+// consumer thread. The caller owns an array of TRIPLE_BUFFER_SLOTS values;
+// this only tracks which slot each side may touch. The producer always has a
+// slot to write into and the consumer always reads the newest published one,
+// so neither side ever waits on the other. Values published faster than they
+// are consumed are overwritten, never queued.
+struct TripleBuffer {
+	// index of the slot between the two sides, TRIPLE_BUFFER_FRESH set while
+	// it holds a value the consumer has not seen
+	atomic_uint shared;
+	// owned by the producer
+	uint32_t back;
+	// owned by the consumer
+	uint32_t front;
+};
+
+void triple_buffer_init(struct TripleBuffer* buffer);
+// Slot the producer fills before calling triple_buffer_publish().
+uint32_t triple_buffer_write_index(struct TripleBuffer* buffer);
+void triple_buffer_publish(struct TripleBuffer* buffer);
+// Moves the consumer to the newest published slot. Returns false, leaving the
+// consumer on its current slot, when nothing new was published.
+bool triple_buffer_acquire(struct TripleBuffer* buffer);
+uint32_t triple_buffer_read_index(struct TripleBuffer* buffer);
+
+#endif
@@ -0,0 +1,79 @@
+#include "uniform_ring.h"
+
+#include <stdio.h>
+
+// Both limits are powers of two, so the larger is a multiple of the smaller.
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize region_granularity(VkDeviceSize alignment, VkDeviceSize atom_size) {
+	return alignment > atom_size ? alignment : atom_size;
+}
+
+VkDeviceSize uniform_ring_buffer_size(VkDeviceSize region_size, uint32_t region_count, VkDeviceSize alignment,
+	VkDeviceSize atom_size) {
+	return align_up(region_size, region_granularity(alignment, atom_size)) * region_count;
+}
+
+bool uniform_ring_init(struct UniformRing* ring, VkDevice device, VkBuffer buffer, VkDeviceMemory memory,
+	bool coherent, VkDeviceSize region_size, uint32_t region_count, VkDeviceSize alignment, VkDeviceSize atom_size) {
+	*ring = (struct UniformRing) {
+		.device = device,
+		.buffer = buffer,
+		.memory = memory,
+		.coherent = coherent,
+		.alignment = alignment,
+		.atom_size = atom_size,
+		.region_count = region_count,
+		// regions start on both limits, so a flush never reaches into a neighbour
+		.region_size = align_up(region_size, region_granularity(alignment, atom_size)),
+	};
+	VkResult result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, (void**) &ring->mapped);
+	if (result != VK_SUCCESS) {
+		printf("Failed to map the uniform ring. Error code: %d\n", result);
+		ring->mapped = NULL;
+		return false;
+	}
+	return true;
+}
+
+void uniform_ring_destroy(struct UniformRing* ring) {
+	if (ring->mapped) {
+		vkUnmapMemory(ring->device, ring->memory);
+		ring->mapped = NULL;
+	}
+}
+
+void uniform_ring_begin_frame(struct UniformRing* ring, uint32_t region) {
+	ring->region_offset = region * ring->region_size;
+	ring->head = 0;
+	ring->flushed = 0;
+}
+
+void* uniform_ring_alloc(struct UniformRing* ring, VkDeviceSize size, uint32_t* offset) {
+	VkDeviceSize start = align_up(ring->head, ring->alignment);
+	if (start + size > ring->region_size) {
+		ring->overflows++;
+		return NULL;
+	}
+	ring->head = start + size;
+	*offset = (uint32_t) (ring->region_offset + start);
+	return ring->mapped + ring->region_offset + start;
+}
+
+void uniform_ring_flush(struct UniformRing* ring) {
+	if (ring->coherent || ring->head == ring->flushed) {
+		return;
+	}
+	// the blocks of a frame are contiguous, so one range covers every write since the last flush
+	VkDeviceSize begin = ring->flushed & ~(ring->atom_size - 1);
+	VkDeviceSize end = align_up(ring->head, ring->atom_size);
+	VkMappedMemoryRange range = {};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = ring->memory;
+	range.offset = ring->region_offset + begin;
+	range.size = end - begin;
+	vkFlushMappedMemoryRanges(ring->device, 1, &range);
+	ring->flushed = ring->head;
+}
@@ -0,0 +1,52 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vulkan/vulkan_core.h>
+
+// Host-visible uniform buffer, mapped once for its whole lifetime and split
+// into one region per frame in flight. A frame sub-allocates its blocks front
+// to back from its region and binds them with dynamic offsets, so streaming
+// per-frame data costs no map, unmap or allocation. A region is only written
+// again once the fence of the frame that last used it has signalled.
+struct UniformRing {
+	VkDevice device;
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	uint8_t* mapped;
+	bool coherent;
+	// minUniformBufferOffsetAlignment, every block starts on it
+	VkDeviceSize alignment;
+	// nonCoherentAtomSize, flushed ranges are rounded out to it
+	VkDeviceSize atom_size;
+	uint32_t region_count;
+	VkDeviceSize region_size;
+	// start of the region being written and the next free byte in it
+	VkDeviceSize region_offset;
+	VkDeviceSize head;
+	// bytes of the region before this are flushed already
+	VkDeviceSize flushed;
+	// allocations refused because a region was full
+	uint64_t overflows;
+};
+
+// Buffer size for region_count regions holding at least region_size bytes each.
+VkDeviceSize uniform_ring_buffer_size(VkDeviceSize region_size, uint32_t region_count, VkDeviceSize alignment,
+	VkDeviceSize atom_size);
+// Maps memory, which backs buffer from offset 0 and was sized by uniform_ring_buffer_size().
+bool uniform_ring_init(struct UniformRing* ring, VkDevice device, VkBuffer buffer, VkDeviceMemory memory,
+	bool coherent, VkDeviceSize region_size, uint32_t region_count, VkDeviceSize alignment, VkDeviceSize atom_size);
+void uniform_ring_destroy(struct UniformRing* ring);
+// Starts writing into region, whose previous frame must have completed.
+void uniform_ring_begin_frame(struct UniformRing* ring, uint32_t region);
+// Reserves size bytes in the current region. Returns where to write them and
+// stores their offset in the buffer to *offset, or returns NULL when the
+// region is full.
+void* uniform_ring_alloc(struct UniformRing* ring, VkDeviceSize size, uint32_t* offset);
+// Makes everything written since the last flush visible to the device with a
+// single vkFlushMappedMemoryRanges call. Does nothing for coherent memory.
+// Call once per frame, before the submit that reads the blocks.
+void uniform_ring_flush(struct UniformRing* ring);
+
+#endif
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Renders one scene headless on lavapipe and compares the last frame with its
+# reference image in golden/, failing on a mismatch or a frame over budget.
+#
+#   tests/golden_test.sh <hello_vulkan> <mesh_tool> <scene> [--update]
+#
+# Scenes: triangle, grid, mesh (depth tested) and msaa (4 samples). Run from
+# the repository root, the renderer loads its shaders from shaders/. --update
+# writes the reference image instead of comparing. References only hold for
+# the driver that made them, so both ways force lavapipe; LAVAPIPE_ICD picks
+# its manifest when it is not in the usual place.
+set -e
+
+if [ $# -lt 3 ]; then
+	echo "Usage: $0 <hello_vulkan> <mesh_tool> <scene> [--update]"
+	exit 2
+fi
+renderer=$1
+mesh_tool=$2
+scene=$3
+tolerance=${GOLDEN_TOLERANCE:-2}
+max_frame_ms=${GOLDEN_MAX_FRAME_MS:-250}
+
+if [ -z "$LAVAPIPE_ICD" ]; then
+	for icd in /usr/share/vulkan/icd.d/lvp_icd.*.json; do
+		LAVAPIPE_ICD=$icd
+	done
+fi
+if [ ! -f "$LAVAPIPE_ICD" ]; then
+	echo "lavapipe not found, set LAVAPIPE_ICD to its ICD manifest."
+	exit 1
+fi
+# the loader reads VK_DRIVER_FILES since 1.3.207, older ones VK_ICD_FILENAMES
+VK_DRIVER_FILES=$LAVAPIPE_ICD
+VK_ICD_FILENAMES=$LAVAPIPE_ICD
+export VK_DRIVER_FILES VK_ICD_FILENAMES
+
+golden=golden/$scene.ppm
+if [ "$4" = "--update" ]; then
+	mkdir -p golden
+	check=--update-golden
+elif [ ! -f "$golden" ]; then
+	echo "$golden is missing. Create it with the update-golden target and commit it."
+	exit 1
+else
+	check="--tolerance $tolerance --max-frame-ms $max_frame_ms"
+fi
+
+case $scene in
+	triangle)
+		args="--scene triangle"
+		;;
+	grid)
+		args="--scene grid"
+		;;
+	mesh)
+		work=$(mktemp -d)
+		trap 'rm -rf "$work"' EXIT
+		"$mesh_tool" tests/torus.obj "$work/torus.mesh" > /dev/null
+		args="--mesh $work/torus.mesh"
+		;;
+	msaa)
+		args="--scene grid --msaa 4"
+		;;
+	*)
+		echo "Unknown scene $scene."
+		exit 2
+		;;
+esac
+
+echo "$scene: $renderer $args"
+"$renderer" --headless --frames 60 --golden "$golden" $check $args